@@ -0,0 +1,111 @@
+
+#include "arena.h"
+#include <stdint.h>
+
+/*
+ * Rounds a pointer up to ARENA_ALIGNMENT.
+ * @param *ptr Pointer to round
+ * @return The first aligned address at or after ptr
+ */
+static char *align_pointer(char *ptr)
+{
+	return (char*) (((uintptr_t) ptr + ARENA_ALIGNMENT - 1) & ~(uintptr_t) (ARENA_ALIGNMENT - 1));
+}
+
+/*
+ * Creates an arena, taking its first region from the heap.
+ * @param region_size Bytes the first region holds. Later regions hold at least as much.
+ * @return The arena, or NULL if the region is too large or the heap has no room for it
+ */
+arena_t *myarena_create(size_t region_size, int line, char *filename)
+{
+	if (region_size > SIZE_MAX - sizeof(arena_t))	// the header would wrap the block's size around
+	{
+		report_error("Error at line %d in file %s: Region is too large! Maximum region: %zu; your region: %zu\n", line, filename, SIZE_MAX - sizeof(arena_t), region_size);
+		return NULL;
+	}
+
+	arena_t *arena = mymalloc(sizeof(arena_t) + region_size, line, filename);
+	if (arena == NULL)
+	{
+		return NULL;
+	}
+
+	arena->regions = NULL;
+	arena->bump = (char*) (arena + 1);
+	arena->end = arena->bump + region_size;
+	arena->region_size = region_size;
+	return arena;
+}
+
+/*
+ * Hands out memory from an arena, taking another region from the heap if the current one is full.
+ * @param *arena Arena to allocate from
+ * @param request_size Amount of bytes requested
+ * @return Pointer aligned to ARENA_ALIGNMENT, or NULL if the request is invalid or the heap is out of memory
+ */
+void *myarena_alloc(arena_t *arena, size_t request_size, int line, char *filename)
+{
+	if (!validate_request(request_size, line, filename))
+	{
+		return NULL;
+	}
+
+	char *data_ptr = align_pointer(arena->bump);
+	if (data_ptr <= arena->end && request_size <= (size_t) (arena->end - data_ptr))	// fits in the current region, aligning can step past its end
+	{
+		arena->bump = data_ptr + request_size;
+		return data_ptr;
+	}
+
+	size_t region_size = request_size + ARENA_ALIGNMENT > arena->region_size ? request_size + ARENA_ALIGNMENT : arena->region_size;
+	arena_region_t *region = mymalloc(sizeof(arena_region_t) + region_size, line, filename);
+	if (region == NULL)
+	{
+		return NULL;
+	}
+
+	region->next = arena->regions;
+	arena->regions = region;
+	arena->end = (char*) (region + 1) + region_size;
+
+	data_ptr = align_pointer((char*) (region + 1));
+	arena->bump = data_ptr + request_size;
+	return data_ptr;
+}
+
+/*
+ * Gives every region after the first back to the heap.
+ * @param *arena Arena to shrink
+ */
+static void release_regions(arena_t *arena, int line, char *filename)
+{
+	while (arena->regions != NULL)
+	{
+		arena_region_t *region = arena->regions;
+		arena->regions = region->next;
+		myfree(region, line, filename);
+	}
+}
+
+/*
+ * Frees every object in an arena at once. Regions after the first go back to the heap, and the first is reused from its start.
+ * @param *arena Arena to reset
+ */
+void myarena_reset(arena_t *arena, int line, char *filename)
+{
+	release_regions(arena, line, filename);
+
+	arena->bump = (char*) (arena + 1);
+	arena->end = arena->bump + arena->region_size;
+}
+
+/*
+ * Frees every object in an arena and the arena itself, giving each region back to the heap as one block.
+ * @param *arena Arena to destroy
+ */
+void myarena_destroy(arena_t *arena, int line, char *filename)
+{
+	release_regions(arena, line, filename);
+	myfree(arena, line, filename);
+}
@@ -0,0 +1,75 @@
+/*
+ * arena.h
+ *
+ *  Arenas for request-scoped objects that are all freed at once.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "mymalloc.h"
+
+#define arena_create(x) myarena_create(x, __LINE__, __FILE__)
+#define arena_alloc(arena, x) myarena_alloc(arena, x, __LINE__, __FILE__)
+#define arena_reset(arena) myarena_reset(arena, __LINE__, __FILE__)
+#define arena_destroy(arena) myarena_destroy(arena, __LINE__, __FILE__)
+
+/*
+ * An arena hands out memory by bumping a pointer through a region taken from the heap as a single block.
+ * Objects have no header of their own and are never freed one by one. Resetting the arena gives all of them back at once.
+ * When a region is full, another region is taken from the heap and chained to the arena.
+ * An arena must only be used by one thread at a time.
+ */
+
+/*
+ * Every object starts at a multiple of this, enough for a pointer, a long or a double,
+ * and never less than NODE_ALIGNMENT, so an object is aligned at least as well as a block from malloc() in the same build.
+ */
+#define ARENA_ALIGNMENT (NODE_ALIGNMENT > 8 ? NODE_ALIGNMENT : 8)
+
+/*
+ * Header of every region after the first, at the start of its block.
+ */
+typedef struct arena_region_t {
+	struct arena_region_t *next;	// Region taken before this one, or NULL
+} arena_region_t;
+
+/*
+ * Header of an arena, at the start of its first region's block. The first region follows it.
+ */
+typedef struct arena_t {
+	arena_region_t *regions;	// Regions taken after the first, newest first
+	char *bump;	// Next free byte of the current region
+	char *end;	// End of the current region
+	size_t region_size;	// Bytes in the first region, and the least in every later one
+} arena_t;
+
+/*
+ * Creates an arena, taking its first region from the heap.
+ * @param region_size Bytes the first region holds. Later regions hold at least as much.
+ * @return The arena, or NULL if the region is too large or the heap has no room for it
+ */
+arena_t *myarena_create(size_t region_size, int line, char *filename);
+
+/*
+ * Hands out memory from an arena, taking another region from the heap if the current one is full.
+ * @param *arena Arena to allocate from
+ * @param request_size Amount of bytes requested
+ * @return Pointer aligned to ARENA_ALIGNMENT, or NULL if the request is invalid or the heap is out of memory
+ */
+void *myarena_alloc(arena_t *arena, size_t request_size, int line, char *filename);
+
+/*
+ * Frees every object in an arena at once. Regions after the first go back to the heap, and the first is reused from its start.
+ * The first region holds the arena's header, which the caller keeps a pointer to, so it stays where it is.
+ * @param *arena Arena to reset
+ */
+void myarena_reset(arena_t *arena, int line, char *filename);
+
+/*
+ * Frees every object in an arena and the arena itself, giving each region back to the heap as one block.
+ * @param *arena Arena to destroy
+ */
+void myarena_destroy(arena_t *arena, int line, char *filename);
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,531 @@
+
+#include "mymalloc.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// the harness calls both allocators by name, so it needs the system allocator as well
+#undef malloc
+#undef free
+#undef calloc
+#undef realloc
+#undef aligned_alloc
+
+#define WARMUP_RUNS 10
+#define MEASURED_RUNS 100
+#define MAX_OPS_PER_RUN 4096
+#define MIXED_SLOTS 64
+#define MIXED_OPS 2000
+#define TOUCH_BLOCKS 6
+#define TOUCH_BLOCK_SIZE 1000
+#define TOUCH_PASSES 4000
+
+/*
+ * An allocator the workloads can run against.
+ */
+typedef struct allocator_t {
+	const char *name;
+	void *(*alloc)(size_t size);
+	void (*release)(void *ptr);
+} allocator_t;
+
+/*
+ * State of one run of a workload.
+ */
+typedef struct bench_t {
+	const allocator_t *allocator;
+	unsigned int seed;	// State for rand_r(), so every run makes the same choices under every allocator
+	long *latencies;	// Where to record the latency of each call in nanoseconds, or NULL to only count calls
+	long num_ops;	// Number of calls made so far
+} bench_t;
+
+/*
+ * A workload, and its name for reports.
+ */
+typedef struct workload_t {
+	const char *name;
+	void (*run)(bench_t *bench);
+} workload_t;
+
+/*
+ * Nanoseconds one clock_gettime() pair adds to a measured call, subtracted from every latency.
+ */
+static long clock_overhead = 0;
+
+void *call_mymalloc(size_t size)
+{
+	return mymalloc(size, __LINE__, __FILE__);
+}
+
+void call_myfree(void *ptr)
+{
+	myfree(ptr, __LINE__, __FILE__);
+}
+
+const allocator_t allocators[] = {
+	{"mymalloc", call_mymalloc, call_myfree},
+	{"glibc", malloc, free},
+};
+
+/*
+ * Reads the monotonic clock.
+ * @return Time in nanoseconds
+ */
+long now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*
+ * Allocates through the allocator under test, timing the call if latencies are being recorded.
+ * @param *bench State of the run
+ * @param size Number of bytes to allocate
+ * @return Pointer returned by the allocator
+ */
+void *bench_alloc(bench_t *bench, size_t size)
+{
+	void *ptr;
+
+	if (bench->latencies == NULL)
+	{
+		ptr = bench->allocator->alloc(size);
+	}
+	else
+	{
+		long start = now_ns();
+		ptr = bench->allocator->alloc(size);
+		long latency = now_ns() - start - clock_overhead;
+		bench->latencies[bench->num_ops] = latency > 0 ? latency : 0;
+	}
+
+	bench->num_ops++;
+	return ptr;
+}
+
+/*
+ * Frees through the allocator under test, timing the call if latencies are being recorded.
+ * @param *bench State of the run
+ * @param *ptr Pointer to free
+ */
+void bench_free(bench_t *bench, void *ptr)
+{
+	if (bench->latencies == NULL)
+	{
+		bench->allocator->release(ptr);
+	}
+	else
+	{
+		long start = now_ns();
+		bench->allocator->release(ptr);
+		long latency = now_ns() - start - clock_overhead;
+		bench->latencies[bench->num_ops] = latency > 0 ? latency : 0;
+	}
+
+	bench->num_ops++;
+}
+
+// malloc() 1 byte and immediately free it - do this 150 times
+void workload_a(bench_t *bench)
+{
+	int i;
+	for (i = 0; i < 150; i++)
+	{
+		bench_free(bench, bench_alloc(bench, 1));
+	}
+}
+
+// malloc() 50 1 byte pointers, then free them one by one - do this 3 times
+void workload_b(bench_t *bench)
+{
+	char *arr[50];
+	int i, j;
+
+	for (i = 0; i < 3; i++)
+	{
+		for (j = 0; j < 50; j++)
+		{
+			arr[j] = bench_alloc(bench, 1);
+		}
+		for (j = 0; j < 50; j++)
+		{
+			bench_free(bench, arr[j]);
+		}
+	}
+}
+
+// randomly malloc() or free() 1 byte pointers until there have been 50 mallocs, then free the rest
+void workload_c(bench_t *bench)
+{
+	char *stack[50];
+	int stack_index = -1;
+	int malloc_count = 0;
+
+	while (malloc_count < 50)
+	{
+		if (rand_r(&bench->seed) % 2 == 1)
+		{
+			stack[++stack_index] = bench_alloc(bench, 1);
+			malloc_count++;
+		}
+		else if (stack_index > -1)
+		{
+			bench_free(bench, stack[stack_index--]);
+		}
+	}
+
+	while (stack_index > -1)
+	{
+		bench_free(bench, stack[stack_index--]);
+	}
+}
+
+// like workload_c(), with random sizes between 1 and 64 bytes, never asking for more than the default heap holds
+void workload_d(bench_t *bench)
+{
+	char *stack[50];
+	int sizes[50];
+	int stack_index = -1;
+	int malloc_count = 0;
+	int memory_left = MYMALLOC_HEAP_SIZE - sizeof(node_t);
+
+	while (malloc_count < 50)
+	{
+		if (rand_r(&bench->seed) % 2 == 1)
+		{
+			int bytes = rand_r(&bench->seed) % 64 + 1;
+			if (bytes + (int) sizeof(node_t) > memory_left)
+			{
+				continue;
+			}
+
+			stack[++stack_index] = bench_alloc(bench, bytes);
+			sizes[stack_index] = bytes;
+			memory_left -= bytes + sizeof(node_t);
+			malloc_count++;
+		}
+		else if (stack_index > -1)
+		{
+			memory_left += sizes[stack_index] + sizeof(node_t);
+			bench_free(bench, stack[stack_index--]);
+		}
+	}
+
+	while (stack_index > -1)
+	{
+		bench_free(bench, stack[stack_index--]);
+	}
+}
+
+// malloc() 512 blocks of 4 bytes, free 50 random ones, malloc() them again, then free everything
+void workload_f(bench_t *bench)
+{
+	char *arr[512];
+	int chosen[50];
+	int i, j;
+
+	for (i = 0; i < 512; i++)
+	{
+		arr[i] = bench_alloc(bench, 4);
+	}
+
+	for (i = 0; i < 50; i++)	// 50 distinct blocks
+	{
+		chosen[i] = rand_r(&bench->seed) % 512;
+		for (j = 0; j < i; j++)
+		{
+			if (chosen[j] == chosen[i])
+			{
+				i--;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < 50; i++)
+	{
+		bench_free(bench, arr[chosen[i]]);
+	}
+	for (i = 0; i < 50; i++)
+	{
+		arr[chosen[i]] = bench_alloc(bench, 4);
+	}
+	for (i = 0; i < 512; i++)
+	{
+		bench_free(bench, arr[i]);
+	}
+}
+
+// randomly malloc() between 1 and 512 bytes into one of 64 slots, or free the slot, keeping at most 4096 bytes in use
+void workload_mixed(bench_t *bench)
+{
+	char *slots[MIXED_SLOTS] = {NULL};
+	int sizes[MIXED_SLOTS];
+	int live_bytes = 0;
+	int i;
+
+	for (i = 0; i < MIXED_OPS; i++)
+	{
+		int slot = rand_r(&bench->seed) % MIXED_SLOTS;
+		int bytes = rand_r(&bench->seed) % 512 + 1;
+
+		if (slots[slot] != NULL)
+		{
+			live_bytes -= sizes[slot];
+			bench_free(bench, slots[slot]);
+			slots[slot] = NULL;
+		}
+		else if (live_bytes + bytes <= 4096)
+		{
+			slots[slot] = bench_alloc(bench, bytes);
+			sizes[slot] = bytes;
+			live_bytes += bytes;
+		}
+	}
+
+	for (i = 0; i < MIXED_SLOTS; i++)
+	{
+		if (slots[i] != NULL)
+		{
+			bench_free(bench, slots[i]);
+		}
+	}
+}
+
+const workload_t workloads[] = {
+	{"A", workload_a},
+	{"B", workload_b},
+	{"C", workload_c},
+	{"D", workload_d},
+	{"F", workload_f},
+	{"mixed", workload_mixed},
+};
+
+/*
+ * Measures how long an empty clock_gettime() pair takes, as the median of many tries.
+ * @return Overhead in nanoseconds
+ */
+long measure_clock_overhead()
+{
+	long samples[1001];
+	int i;
+
+	for (i = 0; i < 1001; i++)
+	{
+		long start = now_ns();
+		samples[i] = now_ns() - start;
+	}
+
+	int j;
+	for (i = 1; i < 1001; i++)	// insertion sort, only done once
+	{
+		long sample = samples[i];
+		for (j = i - 1; j >= 0 && samples[j] > sample; j--)
+		{
+			samples[j + 1] = samples[j];
+		}
+		samples[j + 1] = sample;
+	}
+
+	return samples[500];
+}
+
+/*
+ * Orders latencies for qsort().
+ */
+int compare_latencies(const void *a, const void *b)
+{
+	long first = *(const long*) a;
+	long second = *(const long*) b;
+	return (first > second) - (first < second);
+}
+
+/*
+ * Looks up a percentile of sorted latencies.
+ * @param *latencies Latencies in ascending order
+ * @param num_latencies Number of latencies
+ * @param fraction Percentile as a fraction, such as 0.99
+ * @return The latency at that percentile, in nanoseconds
+ */
+long percentile(long *latencies, long num_latencies, double fraction)
+{
+	return latencies[(long) (fraction * (num_latencies - 1))];
+}
+
+/*
+ * Benchmarks one workload under one allocator, and prints the results.
+ * Throughput is measured over whole runs without per-call timing, and latencies over separate runs that time every call,
+ * so the cost of reading the clock does not count against throughput.
+ * Every run of a workload is seeded the same way under every allocator.
+ * @param *allocator Allocator to use
+ * @param *workload Workload to run
+ * @param seed Seed of the first run, later runs add their run number
+ * @param *latencies Room for MEASURED_RUNS * MAX_OPS_PER_RUN latencies
+ * @param csv True to print a CSV line, false to print a table row
+ */
+void run_benchmark(const allocator_t *allocator, const workload_t *workload, unsigned int seed, long *latencies, bool csv)
+{
+	bench_t bench = {allocator, 0, NULL, 0};
+	int run;
+
+	for (run = 0; run < WARMUP_RUNS; run++)	// fill caches and let the heap settle
+	{
+		bench.seed = seed + run;
+		workload->run(&bench);
+	}
+
+	bench.num_ops = 0;
+	long start = now_ns();
+	for (run = 0; run < MEASURED_RUNS; run++)
+	{
+		bench.seed = seed + run;
+		workload->run(&bench);
+	}
+	double ops_per_sec = bench.num_ops / ((now_ns() - start) * 1e-9);
+
+	bench.latencies = latencies;
+	bench.num_ops = 0;
+	for (run = 0; run < MEASURED_RUNS; run++)
+	{
+		bench.seed = seed + run;
+		workload->run(&bench);
+	}
+	qsort(latencies, bench.num_ops, sizeof(long), compare_latencies);
+
+	printf(csv ? "%s,%s,%.0f,%ld,%ld,%ld\n" : "%-8s %-10s %14.0f %8ld %8ld %8ld\n", workload->name, allocator->name, ops_per_sec,
+			percentile(latencies, bench.num_ops, 0.5), percentile(latencies, bench.num_ops, 0.99), percentile(latencies, bench.num_ops, 0.999));
+}
+
+/*
+ * Measures how fast the user can work on the memory an allocator hands out, rather than how fast it hands it out.
+ * TOUCH_BLOCKS blocks of slightly different sizes, which fit in the default heap, are filled with doubles,
+ * then scaled in place and copied into their neighbours TOUCH_PASSES times. Blocks that are not 16-byte aligned make
+ * more of the loads and stores straddle cache lines.
+ * @param *allocator Allocator to use
+ * @param csv True to print a CSV line, false to print a table row
+ */
+void run_touch_benchmark(const allocator_t *allocator, bool csv)
+{
+	double *blocks[TOUCH_BLOCKS];
+	size_t counts[TOUCH_BLOCKS];
+	int misaligned = 0;
+	int i, pass;
+	size_t j;
+
+	for (i = 0; i < TOUCH_BLOCKS; i++)
+	{
+		size_t size = TOUCH_BLOCK_SIZE + i * 4;
+		blocks[i] = allocator->alloc(size);
+		if (blocks[i] == NULL)
+		{
+			printf("Could not allocate %zu bytes from %s\n", size, allocator->name);
+			while (i-- > 0)
+			{
+				allocator->release(blocks[i]);
+			}
+			return;
+		}
+
+		counts[i] = TOUCH_BLOCK_SIZE / sizeof(double);
+		misaligned += (uintptr_t) blocks[i] % 16 != 0;
+		for (j = 0; j < counts[i]; j++)
+		{
+			blocks[i][j] = j;
+		}
+	}
+
+	long start = now_ns();
+	for (pass = 0; pass < TOUCH_PASSES; pass++)
+	{
+		for (i = 0; i < TOUCH_BLOCKS; i++)
+		{
+			double *block = blocks[i];
+			for (j = 0; j < counts[i]; j++)
+			{
+				block[j] = block[j] * 0.5 + 1.0;
+			}
+			memcpy(blocks[(i + 1) % TOUCH_BLOCKS], block, counts[i] * sizeof(double));
+		}
+	}
+	double seconds = (now_ns() - start) * 1e-9;
+
+	double bytes = (double) TOUCH_PASSES * TOUCH_BLOCKS * (TOUCH_BLOCK_SIZE / sizeof(double)) * sizeof(double) * 4;	// read and write in the loop, read and write in the copy
+	printf(csv ? "touch,%s,%.0f,%d\n" : "%-10s %14.0f %12d\n", allocator->name, bytes / seconds, misaligned);
+
+	for (i = 0; i < TOUCH_BLOCKS; i++)
+	{
+		allocator->release(blocks[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int seed = 1;
+	bool csv = false;
+	int num_workloads = sizeof(workloads) / sizeof(workload_t);
+	int num_allocators = sizeof(allocators) / sizeof(allocator_t);
+	int i, j;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = strtoul(argv[++i], NULL, 10);
+		}
+		else
+		{
+			printf("Usage: %s [--seed <seed>] [--csv]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	long *latencies = malloc(MEASURED_RUNS * MAX_OPS_PER_RUN * sizeof(long));	// the harness's own memory comes from the system allocator
+	if (latencies == NULL)
+	{
+		printf("Could not allocate room for the latencies\n");
+		return 1;
+	}
+
+	clock_overhead = measure_clock_overhead();
+
+	if (csv)
+	{
+		printf("workload,allocator,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+	}
+	else
+	{
+		printf("Seed: %u, warmup runs: %d, measured runs: %d, clock overhead: %ld ns (subtracted from latencies)\n", seed, WARMUP_RUNS, MEASURED_RUNS, clock_overhead);
+		printf("%-8s %-10s %14s %8s %8s %8s\n", "Workload", "Allocator", "ops/sec", "p50 ns", "p99 ns", "p999 ns");
+	}
+
+	for (i = 0; i < num_workloads; i++)
+	{
+		for (j = 0; j < num_allocators; j++)
+		{
+			run_benchmark(&allocators[j], &workloads[i], seed, latencies, csv);
+		}
+	}
+
+	if (csv)
+	{
+		printf("\nkernel,allocator,bytes_per_sec,misaligned_blocks\n");
+	}
+	else
+	{
+		printf("\nUser-side throughput, mymalloc payloads aligned to %zu bytes:\n", NODE_ALIGNMENT);
+		printf("%-10s %14s %12s\n", "Allocator", "bytes/sec", "misaligned");
+	}
+
+	for (j = 0; j < num_allocators; j++)
+	{
+		run_touch_benchmark(&allocators[j], csv);
+	}
+
+	free(latencies);
+	return 0;
+}
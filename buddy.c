@@ -0,0 +1,246 @@
+
+#include "buddy.h"
+
+/*
+ * The heap the blocks are laid over, and how much of it the buddy system covers.
+ */
+static char *buddy_heap = NULL;
+static size_t buddy_size = 0;
+
+/*
+ * Free blocks, one list per order. A value of -1 marks an empty list.
+ * Bit k of order_bitmap is set if the list for order k is non-empty.
+ */
+static int free_lists[BUDDY_MAX_ORDER + 1];
+static unsigned int order_bitmap = 0;
+
+/*
+ * Writes the header of a block.
+ * @param curr_mem_index Index of the block
+ * @param order Order of the block
+ * @param active Whether the block is handed out
+ */
+static void set_header(int curr_mem_index, int order, bool active)
+{
+	node_t *header = (node_t*) &buddy_heap[curr_mem_index];
+
+	header->size = (1U << order) - sizeof(node_t);
+	header->active = active;
+	header->prev_active = 1;	// blocks never look at their neighbours
+}
+
+/*
+ * Looks up the free links stored in a free block's data section.
+ * @param curr_mem_index Index of the block
+ * @return Pointer to the links
+ */
+static free_links_t *get_block_links(int curr_mem_index)
+{
+	return (free_links_t*) &buddy_heap[curr_mem_index + sizeof(node_t)];
+}
+
+/*
+ * Marks a block as free and adds it to the front of the list for its order.
+ * @param curr_mem_index Index of the block
+ * @param order Order of the block
+ */
+static void push_block(int curr_mem_index, int order)
+{
+	free_links_t *links = get_block_links(curr_mem_index);
+
+	set_header(curr_mem_index, order, 0);
+	links->prev_index = -1;
+	links->next_index = free_lists[order];
+
+	if (free_lists[order] > -1)	// old head now comes after this block
+	{
+		get_block_links(free_lists[order])->prev_index = curr_mem_index;
+	}
+
+	free_lists[order] = curr_mem_index;
+	order_bitmap |= 1U << order;
+}
+
+/*
+ * Unlinks a free block from the list for its order.
+ * @param curr_mem_index Index of the block
+ * @param order Order of the block
+ */
+static void unlink_block(int curr_mem_index, int order)
+{
+	free_links_t *links = get_block_links(curr_mem_index);
+
+	if (links->prev_index > -1)
+	{
+		get_block_links(links->prev_index)->next_index = links->next_index;
+	}
+	else	// block was the head of its list
+	{
+		free_lists[order] = links->next_index;
+		if (free_lists[order] < 0)
+		{
+			order_bitmap &= ~(1U << order);
+		}
+	}
+
+	if (links->next_index > -1)
+	{
+		get_block_links(links->next_index)->prev_index = links->prev_index;
+	}
+}
+
+/*
+ * Merges a block that is no longer handed out with its buddy, for as long as the buddy is free and of the same order,
+ * then adds the result to the free lists.
+ * The buddy's header is always the real header of whatever block starts there, since blocks never straddle an aligned boundary of their own size.
+ * @param curr_mem_index Index of the block
+ * @param order Order of the block
+ */
+static void merge_block(int curr_mem_index, int order)
+{
+	while (order < BUDDY_MAX_ORDER)
+	{
+		int buddy_index = curr_mem_index ^ (1 << order);
+		if (buddy_index + ((size_t) 1 << order) > buddy_size)	// buddy is not part of the heap yet
+		{
+			break;
+		}
+
+		node_t *buddy = (node_t*) &buddy_heap[buddy_index];
+		if (buddy->active || buddy->size != (1U << order) - sizeof(node_t))	// buddy is handed out, or split into smaller blocks
+		{
+			break;
+		}
+
+		unlink_block(buddy_index, order);
+		curr_mem_index &= ~(1 << order);	// merged block starts at the lower of the two
+		order++;
+		stat_add(merges, 1);
+	}
+
+	push_block(curr_mem_index, order);
+}
+
+/*
+ * Lays a buddy system over the start of the heap.
+ * @param *heap Start of the heap, readable and writable
+ * @param heap_size Number of usable bytes in the heap, a multiple of 2^BUDDY_MIN_ORDER
+ */
+void buddy_init(char *heap, size_t heap_size)
+{
+	buddy_heap = heap;
+	buddy_size = 0;
+	order_bitmap = 0;
+
+	int i;
+	for (i = 0; i <= BUDDY_MAX_ORDER; i++)
+	{
+		free_lists[i] = -1;
+	}
+
+	buddy_grow(heap_size);
+}
+
+/*
+ * Adds the bytes the heap has grown by to the buddy system, as the largest aligned blocks that fit.
+ * Each new block is merged with its buddy if the buddy is free.
+ * @param heap_size New number of usable bytes in the heap, a multiple of 2^BUDDY_MIN_ORDER
+ */
+void buddy_grow(size_t heap_size)
+{
+	while (buddy_size < heap_size)
+	{
+		int order = buddy_size > 0 ? __builtin_ctzl(buddy_size) : BUDDY_MAX_ORDER;	// block must be aligned to its size
+
+		if (order > BUDDY_MAX_ORDER)
+		{
+			order = BUDDY_MAX_ORDER;
+		}
+		while (((size_t) 1 << order) > heap_size - buddy_size)	// and must fit in what is left
+		{
+			order--;
+		}
+
+		int curr_mem_index = buddy_size;
+		buddy_size += (size_t) 1 << order;
+		merge_block(curr_mem_index, order);
+	}
+}
+
+/*
+ * Determines the order of the smallest block that holds a given number of bytes.
+ * @param block_size Number of bytes, including the header
+ * @return Order of the block, at least BUDDY_MIN_ORDER
+ */
+int buddy_order(unsigned int block_size)
+{
+	if (block_size <= (1U << BUDDY_MIN_ORDER))
+	{
+		return BUDDY_MIN_ORDER;
+	}
+
+	return 32 - __builtin_clz(block_size - 1);	// position of the highest bit of the next power of two
+}
+
+/*
+ * Takes the smallest free block that fits a request, splitting a larger block in halves as many times as needed.
+ * @param request_size Amount of space requested, not counting the header
+ * @return Index of the block's header, or -1 if there is no free block large enough
+ */
+int buddy_alloc(unsigned int request_size)
+{
+	int order = buddy_order(request_size + sizeof(node_t));
+	if (order > BUDDY_MAX_ORDER)
+	{
+		return -1;
+	}
+
+	unsigned int orders = order_bitmap & (~0U << order);	// non-empty lists of blocks large enough
+	if (orders == 0)
+	{
+		return -1;
+	}
+
+	int block_order = __builtin_ctz(orders);
+	int curr_mem_index = free_lists[block_order];
+	unlink_block(curr_mem_index, block_order);
+
+	while (block_order > order)	// keep the lower half, free the upper half
+	{
+		block_order--;
+		push_block(curr_mem_index + (1 << block_order), block_order);
+		stat_add(splits, 1);
+	}
+
+	set_header(curr_mem_index, order, 1);
+	return curr_mem_index;
+}
+
+/*
+ * Frees a block, and merges it with its buddy for as long as the buddy is free and whole.
+ * @param curr_mem_index Index of a validated, active block
+ */
+void buddy_free(int curr_mem_index)
+{
+	node_t *header = (node_t*) &buddy_heap[curr_mem_index];
+	merge_block(curr_mem_index, buddy_order(header->size + sizeof(node_t)));
+}
+
+/*
+ * Determines whether or not an index holds the header of a block, by checking its size and alignment.
+ * @param curr_mem_index Prospective index of a block's header
+ * @return True if the header describes a block that could start at this index, false otherwise
+ */
+bool buddy_validate(int curr_mem_index)
+{
+	if (curr_mem_index < 0 || curr_mem_index % (1 << BUDDY_MIN_ORDER) != 0 || (size_t) curr_mem_index >= buddy_size)	// blocks only start at aligned indices
+	{
+		return false;
+	}
+
+	node_t *header = (node_t*) &buddy_heap[curr_mem_index];
+	unsigned int block_size = header->size + sizeof(node_t);
+
+	return block_size >= (1U << BUDDY_MIN_ORDER) && (block_size & (block_size - 1)) == 0	// a power of two
+			&& curr_mem_index % block_size == 0 && curr_mem_index + block_size <= buddy_size;
+}
@@ -0,0 +1,75 @@
+/*
+ * buddy.h
+ *
+ *  Binary buddy allocator, an alternative to the node heap.
+ */
+
+#ifndef BUDDY_H_
+#define BUDDY_H_
+
+#include "mymalloc.h"
+
+/*
+ * Buddy system mode, enabled by building with -DMYMALLOC_BUDDY.
+ * Blocks that do not fit in a slab come from a buddy system laid over the heap instead of from bins of nodes.
+ * Every block is a power of two in size, including its node_t header, and starts at an index that is a multiple of its size.
+ * The buddy of a block of size 2^k at index i is at i ^ 2^k, so freeing a block merges it without walking its neighbours.
+ */
+
+/*
+ * Smallest block, as a power of two. It must hold a header and, once freed, its free links.
+ * Aligned layout mode has 16-byte headers, so its smallest block is twice as large.
+ */
+#ifdef MYMALLOC_ALIGN16
+#define BUDDY_MIN_ORDER 5
+#else
+#define BUDDY_MIN_ORDER 4
+#endif
+
+/*
+ * Largest block, as a power of two. Node sizes are 30 bits wide, and the heap is at most HEAP_SIZE_LIMIT.
+ */
+#define BUDDY_MAX_ORDER 30
+
+/*
+ * Lays a buddy system over the start of the heap.
+ * @param *heap Start of the heap, readable and writable
+ * @param heap_size Number of usable bytes in the heap, a multiple of 2^BUDDY_MIN_ORDER
+ */
+void buddy_init(char *heap, size_t heap_size);
+
+/*
+ * Adds the bytes the heap has grown by to the buddy system, as the largest aligned blocks that fit.
+ * Each new block is merged with its buddy if the buddy is free.
+ * @param heap_size New number of usable bytes in the heap, a multiple of 2^BUDDY_MIN_ORDER
+ */
+void buddy_grow(size_t heap_size);
+
+/*
+ * Determines the order of the smallest block that holds a given number of bytes.
+ * @param block_size Number of bytes, including the header
+ * @return Order of the block, at least BUDDY_MIN_ORDER
+ */
+int buddy_order(unsigned int block_size);
+
+/*
+ * Takes the smallest free block that fits a request, splitting a larger block in halves as many times as needed.
+ * @param request_size Amount of space requested, not counting the header
+ * @return Index of the block's header, or -1 if there is no free block large enough
+ */
+int buddy_alloc(unsigned int request_size);
+
+/*
+ * Frees a block, and merges it with its buddy for as long as the buddy is free and whole.
+ * @param curr_mem_index Index of a validated, active block
+ */
+void buddy_free(int curr_mem_index);
+
+/*
+ * Determines whether or not an index holds the header of a block, by checking its size and alignment.
+ * @param curr_mem_index Prospective index of a block's header
+ * @return True if the header describes a block that could start at this index, false otherwise
+ */
+bool buddy_validate(int curr_mem_index);
+
+#endif /* BUDDY_H_ */
@@ -0,0 +1,210 @@
+
+#define _GNU_SOURCE	// for mremap()
+#include "huge.h"
+#include "mymalloc.h"
+#include <sys/mman.h>
+
+/*
+ * Huge blocks that are handed out, as an open-addressed hash table keyed on their address.
+ * The table is mapped on the first huge allocation, and mapped again at twice the size whenever it would become more than half full.
+ */
+static huge_block_t *huge_blocks = NULL;
+static size_t huge_table_size = 0;
+static size_t num_huge_blocks = 0;
+
+/*
+ * Hashes a block's address into a table index.
+ * @param *ptr Start of the block
+ * @return Index to start probing at
+ */
+static unsigned int hash_block(void *ptr)
+{
+	return (unsigned int) (((uintptr_t) ptr * 0x9E3779B97F4A7C15ULL) >> 32) & (huge_table_size - 1);
+}
+
+/*
+ * Finds the entry of a huge block, or the empty entry where it belongs.
+ * @param *ptr Start of the block
+ * @return Index of the entry
+ */
+static unsigned int find_huge_block(void *ptr)
+{
+	unsigned int i = hash_block(ptr);
+
+	while (huge_blocks[i].ptr != NULL && huge_blocks[i].ptr != ptr)
+	{
+		i = (i + 1) & (huge_table_size - 1);
+	}
+
+	return i;
+}
+
+/*
+ * Maps a table twice the size of the current one, or HUGE_TABLE_INITIAL_SIZE entries if there is none yet,
+ * moves every entry into it and unmaps the old one.
+ * @return True if the table grew, false if the new table could not be mapped, in which case the old one is kept
+ */
+static bool grow_huge_table()
+{
+	huge_block_t *old_blocks = huge_blocks;
+	size_t old_size = huge_table_size;
+	size_t new_size = old_size > 0 ? old_size * 2 : HUGE_TABLE_INITIAL_SIZE;
+
+	void *table = mmap(NULL, round_to_pages(new_size * sizeof(huge_block_t)), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (table == MAP_FAILED)
+	{
+		return false;
+	}
+
+	huge_blocks = table;	// zero from mmap(), so every entry is unused
+	huge_table_size = new_size;
+
+	size_t i;
+	for (i = 0; i < old_size; i++)
+	{
+		if (old_blocks[i].ptr != NULL)
+		{
+			huge_blocks[find_huge_block(old_blocks[i].ptr)] = old_blocks[i];
+		}
+	}
+
+	if (old_blocks != NULL)
+	{
+		munmap(old_blocks, round_to_pages(old_size * sizeof(huge_block_t)));
+	}
+	return true;
+}
+
+/*
+ * Removes a huge block's entry, moving later entries of its probe run back so lookups never stop early.
+ * @param hole Index of the entry to remove
+ */
+static void remove_huge_block(unsigned int hole)
+{
+	unsigned int i = hole;
+
+	huge_blocks[hole].ptr = NULL;
+	num_huge_blocks--;
+
+	while (true)
+	{
+		i = (i + 1) & (huge_table_size - 1);
+		if (huge_blocks[i].ptr == NULL)
+		{
+			return;
+		}
+
+		unsigned int home = hash_block(huge_blocks[i].ptr);
+		if (((i - home) & (huge_table_size - 1)) >= ((i - hole) & (huge_table_size - 1)))	// entry can fill the hole
+		{
+			huge_blocks[hole] = huge_blocks[i];
+			huge_blocks[i].ptr = NULL;
+			hole = i;
+		}
+	}
+}
+
+/*
+ * Maps a huge block and adds it to the table.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Amount of bytes requested, rounded up to a whole number of pages
+ * @return Pointer to the block, aligned to a page, or NULL if it or a larger table could not be mapped
+ */
+void *huge_alloc(size_t request_size)
+{
+	if (num_huge_blocks >= huge_table_size / 2 && !grow_huge_table())	// keep probes short
+	{
+		return NULL;
+	}
+
+	size_t size = round_to_pages(request_size);
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	unsigned int i = find_huge_block(ptr);
+	huge_blocks[i].ptr = ptr;
+	huge_blocks[i].size = size;
+	num_huge_blocks++;
+	return ptr;
+}
+
+/*
+ * Looks up the size of a huge block.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Any pointer
+ * @return Size of the block's mapping if ptr is a huge block that is handed out, and 0 otherwise
+ */
+size_t huge_usable_size(void *ptr)
+{
+	if (num_huge_blocks == 0 || ptr == NULL)
+	{
+		return 0;
+	}
+
+	unsigned int i = find_huge_block(ptr);
+	return huge_blocks[i].ptr != NULL ? huge_blocks[i].size : 0;
+}
+
+/*
+ * Removes a huge block from the table and unmaps it, giving its memory back to the operating system.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Any pointer
+ * @return True if ptr was a huge block that is handed out, false otherwise
+ */
+bool huge_free(void *ptr)
+{
+	if (num_huge_blocks == 0 || ptr == NULL)
+	{
+		return false;
+	}
+
+	unsigned int i = find_huge_block(ptr);
+	if (huge_blocks[i].ptr == NULL)
+	{
+		return false;
+	}
+
+	munmap(ptr, huge_blocks[i].size);
+	remove_huge_block(i);
+	return true;
+}
+
+/*
+ * Resizes a huge block with mremap(), which moves its pages instead of copying them if the block has to move.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer to a huge block that is handed out
+ * @param request_size New size in bytes, rounded up to a whole number of pages
+ * @return Pointer to the resized block, or NULL if it could not be resized, in which case it is left as it was
+ */
+void *huge_resize(void *ptr, size_t request_size)
+{
+	unsigned int i = find_huge_block(ptr);
+	size_t size = round_to_pages(request_size);
+
+	if (size == huge_blocks[i].size)
+	{
+		return ptr;
+	}
+
+	void *new_ptr = mremap(ptr, huge_blocks[i].size, size, MREMAP_MAYMOVE);
+	if (new_ptr == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	if (new_ptr == ptr)
+	{
+		huge_blocks[i].size = size;
+		return ptr;
+	}
+
+	remove_huge_block(i);	// block moved, so it belongs in a different entry
+	i = find_huge_block(new_ptr);
+	huge_blocks[i].ptr = new_ptr;
+	huge_blocks[i].size = size;
+	num_huge_blocks++;
+	return new_ptr;
+}
@@ -0,0 +1,61 @@
+/*
+ * huge.h
+ *
+ *  Huge blocks, each in a mapping of its own.
+ */
+
+#ifndef HUGE_H_
+#define HUGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Number of entries the table of huge blocks starts with. It doubles whenever more than half of them would be used, which keeps probes short.
+ */
+#define HUGE_TABLE_INITIAL_SIZE 4096
+
+/*
+ * A huge block that is handed out. The block starts at the start of its mapping, so it needs no header,
+ * and is found by its address in an open-addressed hash table instead.
+ */
+typedef struct huge_block_t {
+	void *ptr;	// Start of the mapping, or NULL for an unused entry
+	size_t size;	// Size of the mapping, a whole number of pages
+} huge_block_t;
+
+/*
+ * Maps a huge block and adds it to the table.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Amount of bytes requested, rounded up to a whole number of pages
+ * @return Pointer to the block, aligned to a page, or NULL if it or a larger table could not be mapped
+ */
+void *huge_alloc(size_t request_size);
+
+/*
+ * Looks up the size of a huge block.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Any pointer
+ * @return Size of the block's mapping if ptr is a huge block that is handed out, and 0 otherwise
+ */
+size_t huge_usable_size(void *ptr);
+
+/*
+ * Removes a huge block from the table and unmaps it, giving its memory back to the operating system.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Any pointer
+ * @return True if ptr was a huge block that is handed out, false otherwise
+ */
+bool huge_free(void *ptr);
+
+/*
+ * Resizes a huge block with mremap(), which moves its pages instead of copying them if the block has to move.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer to a huge block that is handed out
+ * @param request_size New size in bytes, rounded up to a whole number of pages
+ * @return Pointer to the resized block, or NULL if it could not be resized, in which case it is left as it was
+ */
+void *huge_resize(void *ptr, size_t request_size);
+
+#endif /* HUGE_H_ */
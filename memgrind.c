@@ -1,6 +1,14 @@
 
 #include "mymalloc.h"
-#include <sys/time.h>
+#include "arena.h"
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define POLICY_SLOTS 64
+#define POLICY_CHURN_OPS 20000
+#define SPIKE_BYTES (16 * 1024 * 1024)
 
 // malloc() 1 byte and immediately free it - do this 150 times
 void workload_a()
@@ -73,11 +81,11 @@ void workload_c()
 
 /*
  * Helper method for workload_d(). Used to get the size of the pointer that is being freed.
+ * Tiny blocks live in slabs and have no node of their own, so this asks the allocator rather than reading the node.
 */
 int get_node_size(void * ptr)
 {
-	node_t * curr_node = ptr - sizeof(node_t);
-	return curr_node->size + sizeof(node_t);
+	return mymalloc_usable_size(ptr) + sizeof(node_t);
 }
 
 /*
@@ -94,7 +102,7 @@ void workload_d()
 	int stackIndex = -1;
 	char * stack[50];
 
-	int totalMemoryLeft = 4092;
+	int totalMemoryLeft = MYMALLOC_HEAP_SIZE - sizeof(node_t);
 
 	while(mallocCount < 50){
 		int action = rand()%2;
@@ -102,7 +110,7 @@ void workload_d()
 //		printf("%d\n", totalMemoryLeft);
 		if(action == 1){		//if action == 1, malloc()
 			int bytes = rand()%64 + 1;		//get a random allocation size
-			if(bytes + sizeof(node_t) > totalMemoryLeft){
+			if(bytes + (int) sizeof(node_t) > totalMemoryLeft){
 				continue;
 			}
 			stackIndex++;
@@ -163,6 +171,13 @@ void workload_e()
 		arrIndex++;
 	}
 
+	//show why malloc failed, the first time only
+	static bool analyzed = false;
+	if(!analyzed){
+		export_heap_analysis(stdout, FORMAT_JSON);
+		analyzed = true;
+	}
+
 	//free pointers
 	int i;
 	for(i = 0; i < arrIndex; i++){
@@ -242,15 +257,13 @@ void workload_f()
  */
 double timed_execution(void (*func)())
 {
-	struct timeval start, end;
-	double time_elapsed;
+	struct timespec start, end;
 
-	gettimeofday(&start, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);	// unlike gettimeofday(), never jumps when the system time is changed
 	func();
-	gettimeofday(&end, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	time_elapsed = (end.tv_sec - start.tv_sec) * 1e6;
-	return (time_elapsed + (end.tv_usec - start.tv_usec)) * 1e-6;
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
 }
 
 /*
@@ -286,8 +299,505 @@ void print_avg_times(double *workload_avgs, short num_workloads)
 	}
 }
 
+/*
+ * Randomly malloc() between 65 and 512 bytes (too big for slabs) or free() a pointer, keeping at most half the heap in use.
+ * Then keep malloc()ing without freeing until malloc() fails, to see how much of the fragmented heap is still usable.
+ * @param *ops Set to the number of malloc() and free() calls made
+ * @return Most bytes that were handed out at the same time, counting usable sizes
+ */
+size_t fragment_heap(long *ops)
+{
+	char *slots[POLICY_SLOTS] = {NULL};
+	size_t live_bytes = 0;
+	size_t peak_bytes = 0;
+	int i;
+
+	*ops = 0;
+	for (i = 0; i < POLICY_CHURN_OPS; i++)
+	{
+		int slot = rand() % POLICY_SLOTS;
+		int bytes = rand() % 448 + 65;
+
+		if (slots[slot] != NULL)
+		{
+			live_bytes -= mymalloc_usable_size(slots[slot]);
+			free(slots[slot]);
+			slots[slot] = NULL;
+		}
+		else if (live_bytes + bytes <= MYMALLOC_HEAP_SIZE / 2)
+		{
+			slots[slot] = malloc(bytes);
+			if (slots[slot] != NULL)
+			{
+				live_bytes += mymalloc_usable_size(slots[slot]);
+			}
+		}
+		else
+		{
+			continue;
+		}
+		(*ops)++;
+
+		if (live_bytes > peak_bytes)
+		{
+			peak_bytes = live_bytes;
+		}
+	}
+
+	char *ptr;
+	do	// fill whatever is left, until the first failure
+	{
+		ptr = malloc(rand() % 448 + 65);
+		(*ops)++;
+		if (ptr != NULL)
+		{
+			live_bytes += mymalloc_usable_size(ptr);
+		}
+	} while (ptr != NULL);
+
+	return live_bytes > peak_bytes ? live_bytes : peak_bytes;
+}
+
+/*
+ * Runs fragment_heap() once under every placement policy, and prints its throughput and peak usable memory.
+ * The policy can only be chosen before the heap is set up, so each run happens in a child process with a fresh heap.
+ * Placement policies do not apply to the buddy system, so it is run once instead.
+ * @param seed Seed for rand(), the same under every policy
+ */
+void compare_policies(unsigned int seed)
+{
+#ifdef MYMALLOC_BUDDY
+	placement_policy num_policies = 1;
+#else
+	placement_policy num_policies = NUM_POLICIES;
+#endif
+
+	placement_policy policy;
+	for (policy = 0; policy < num_policies; policy++)
+	{
+		fflush(stdout);	// keep the child from printing the parent's buffered output again
+		pid_t pid = fork();
+
+		if (pid == 0)
+		{
+			struct timespec start, end;
+			long ops;
+
+#ifdef MYMALLOC_BUDDY
+			const char *policy_name = "buddy system";
+#else
+			const char *policy_name = get_policy_name(policy);
+			mymalloc_set_policy(policy);
+#endif
+			srand(seed);	// same requests under every policy
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			size_t peak_bytes = fragment_heap(&ops);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			double time_elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+			printf("Policy %-14s: %10.0f ops/sec, peak usable memory: %5zu of %d bytes\n", policy_name, ops / time_elapsed, peak_bytes, MYMALLOC_HEAP_SIZE);
+			exit(0);
+		}
+		else if (pid > 0)
+		{
+			waitpid(pid, NULL, 0);
+		}
+	}
+}
+
+/*
+ * Reads how much of this process's memory is resident, from /proc/self/statm.
+ * @return Resident memory in KiB, or 0 if it could not be read
+ */
+size_t read_rss_kib()
+{
+	FILE *statm = fopen("/proc/self/statm", "r");
+	unsigned long size_pages, resident_pages = 0;
+
+	if (statm == NULL)
+	{
+		return 0;
+	}
+	if (fscanf(statm, "%lu %lu", &size_pages, &resident_pages) != 2)
+	{
+		resident_pages = 0;
+	}
+	fclose(statm);
+
+	return resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * Grows the heap to SPIKE_BYTES with 4000-byte blocks, which are too small for mappings of their own, writes to all of them and frees them all again.
+ * Prints the resident memory before the spike, at its peak, after the frees, which trim the heap every MYMALLOC_TRIM_THRESHOLD bytes,
+ * and after mymalloc_trim(). The heap can only grow before it is set up, so this happens in a child process with a fresh heap.
+ */
+void trim_spike()
+{
+	fflush(stdout);	// keep the child from printing the parent's buffered output again
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		static char *blocks[SPIKE_BYTES / 4000];
+		int num_blocks = 0;
+		int i;
+
+		mymalloc_init(MYMALLOC_HEAP_SIZE, 2 * SPIKE_BYTES);
+		free(malloc(100));	// sets up the heap, so its reservation is not part of the spike
+		size_t rss_before = read_rss_kib();
+
+		while (num_blocks < SPIKE_BYTES / 4000 && (blocks[num_blocks] = malloc(4000)) != NULL)
+		{
+			memset(blocks[num_blocks++], 1, 4000);
+		}
+		size_t rss_spike = read_rss_kib();
+
+		for (i = 0; i < num_blocks; i++)
+		{
+			free(blocks[i]);
+		}
+		size_t rss_freed = read_rss_kib();
+
+		size_t trimmed = mymalloc_trim();
+		size_t rss_trimmed = read_rss_kib();
+
+		printf("Resident memory: %zu KiB before a spike of %d blocks, %zu KiB at its peak, %zu KiB once they are freed, %zu KiB after mymalloc_trim() gave back %zu KiB\n",
+				rss_before, num_blocks, rss_spike, rss_freed, rss_trimmed, trimmed / 1024);
+		exit(0);
+	}
+	else if (pid > 0)
+	{
+		waitpid(pid, NULL, 0);
+	}
+}
+
+/*
+ * Times workload_b()'s pattern of allocating 50 blocks and then freeing them all, one call per block and then one call per batch,
+ * for tiny blocks that come from slabs and for blocks that need nodes. Prints the mean cost per block of each.
+ */
+void compare_batch()
+{
+	size_t sizes[] = {1, 100};
+	void *arr[50];
+	struct timespec start, middle, end;
+	int i, j, k;
+
+	for (i = 0; i < 2; i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (j = 0; j < 300; j++)	// 100 runs of 3 rounds each, like workload_b()
+		{
+			for (k = 0; k < 50; k++)
+			{
+				arr[k] = malloc(sizes[i]);
+			}
+			for (k = 0; k < 50; k++)
+			{
+				free(arr[k]);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &middle);
+		for (j = 0; j < 300; j++)
+		{
+			malloc_batch(50, sizes[i], arr);
+			free_batch(arr, 50);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double single_ns = ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / (300 * 50);
+		double batch_ns = ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / (300 * 50);
+		printf("%3zu-byte blocks: %6.1f ns per block one at a time, %6.1f ns per block in batches\n", sizes[i], single_ns, batch_ns);
+	}
+}
+
+/*
+ * Times allocating 50 blocks of 1 to 64 bytes and then freeing them all, like the end of workload_d(),
+ * first with malloc() and free() and then from an arena that is reset instead. Prints the mean cost per block of each.
+ */
+void compare_arena()
+{
+	char *arr[50];
+	int sizes[50];
+	struct timespec start, middle, end;
+	int i, j;
+
+	for (i = 0; i < 50; i++)
+	{
+		sizes[i] = rand() % 64 + 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 300; i++)
+	{
+		for (j = 0; j < 50; j++)
+		{
+			arr[j] = malloc(sizes[j]);
+			arr[j][0] = j;
+		}
+		for (j = 0; j < 50; j++)
+		{
+			free(arr[j]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &middle);
+
+	arena_t *arena = arena_create(50 * 64);
+	for (i = 0; i < 300; i++)
+	{
+		for (j = 0; j < 50; j++)
+		{
+			arr[j] = arena_alloc(arena, sizes[j]);
+			arr[j][0] = j;
+		}
+		arena_reset(arena);
+	}
+	arena_destroy(arena);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	arena_create(SIZE_MAX);	// reported, the header does not fit in front of it
+
+	double heap_ns = ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / (300 * 50);
+	double arena_ns = ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / (300 * 50);
+	printf("1-64 byte blocks: %6.1f ns per block with malloc() and free(), %6.1f ns per block from an arena\n", heap_ns, arena_ns);
+}
+
+/*
+ * Allocates 10 blocks of 100 to 500 bytes for one subsystem, each followed by a block of the same size for the rest of the program,
+ * 300 times over. The first run takes every block from the default heap, the second puts the subsystem's blocks in a heap of their own.
+ * The heap is created before the second run is timed and destroyed after it, so only the allocations and frees are measured.
+ * Prints the bytes the subsystem's blocks spanned, and the mean cost per block of each run.
+ */
+void compare_heaps()
+{
+	char *ours[10];
+	char *others[10];
+	int sizes[10];
+	struct timespec start, middle, own_start, end;
+	uintptr_t heap_span = 0, own_span = 0;
+	int i, j;
+
+#ifdef MYMALLOC_BUDDY
+	return;	// the buddy system only has the default heap
+#endif
+
+	for (i = 0; i < 10; i++)
+	{
+		sizes[i] = rand() % 401 + 100;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 300; i++)
+	{
+		for (j = 0; j < 10; j++)
+		{
+			ours[j] = malloc(sizes[j]);
+			ours[j][0] = j;
+			others[j] = malloc(sizes[j]);
+		}
+		heap_span = (uintptr_t) ours[9] + sizes[9] - (uintptr_t) ours[0];
+		for (j = 0; j < 10; j++)
+		{
+			free(ours[j]);
+			free(others[j]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &middle);
+
+	heap_t *heap = heap_create(10 * 512);	// its mmap() and munmap() are not part of the per-block cost
+	if (heap == NULL)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &own_start);
+	for (i = 0; i < 300; i++)
+	{
+		for (j = 0; j < 10; j++)
+		{
+			ours[j] = heap_alloc(heap, sizes[j]);
+			ours[j][0] = j;
+			others[j] = malloc(sizes[j]);
+		}
+		own_span = (uintptr_t) ours[9] + sizes[9] - (uintptr_t) ours[0];
+		for (j = 0; j < 10; j++)
+		{
+			heap_free(heap, ours[j]);
+			free(others[j]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	heap_destroy(heap);
+	heap_destroy(heap);	// reported, the handle is gone
+
+	double heap_ns = ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / (300 * 20);
+	double own_ns = ((end.tv_sec - own_start.tv_sec) * 1e9 + (end.tv_nsec - own_start.tv_nsec)) / (300 * 20);
+	printf("100-500 byte blocks: %4lu bytes spanned and %6.1f ns per block in the default heap, %4lu bytes and %6.1f ns per block in a heap of their own\n",
+			(unsigned long) heap_span, heap_ns, (unsigned long) own_span, own_ns);
+}
+
+/*
+ * Runs the churn of workload_a() and workload_c() with 100-byte blocks, which need nodes, first coalescing every free and then deferring it.
+ * Prints the mean cost per call of each, and how many nodes were split and merged if the allocator was built with -DMYMALLOC_STATS.
+ * Each run happens in a child process with a fresh heap. The counters are inherited from the parent, so the child reports how far they moved.
+ * @param seed Seed for rand(), the same in both runs
+ */
+void compare_coalescing(unsigned int seed)
+{
+	int deferred;
+	for (deferred = 0; deferred < 2; deferred++)
+	{
+		fflush(stdout);	// keep the child from printing the parent's buffered output again
+		pid_t pid = fork();
+
+		if (pid == 0)
+		{
+			struct timespec start, end;
+			mymalloc_stats_t before, after;
+			char *stack[50];
+			long calls = 0;
+			int i, j;
+
+			mymalloc_set_deferred_coalescing(deferred);
+			mymalloc_get_stats(&before);
+			srand(seed);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (i = 0; i < 100; i++)
+			{
+				for (j = 0; j < 150; j++)	// workload_a()
+				{
+					free(malloc(100));
+				}
+				calls += 300;
+
+				int stack_index = -1;
+				int malloc_count = 0;
+				while (malloc_count < 50)	// workload_c()
+				{
+					if (rand() % 2 == 1)
+					{
+						stack[++stack_index] = malloc(100);
+						malloc_count++;
+					}
+					else if (stack_index > -1)
+					{
+						free(stack[stack_index--]);
+					}
+					else
+					{
+						continue;
+					}
+					calls++;
+				}
+				while (stack_index > -1)
+				{
+					free(stack[stack_index--]);
+					calls++;
+				}
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			double call_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / calls;
+			printf("%-8s coalescing: %6.1f ns per call", deferred ? "Deferred" : "Eager", call_ns);
+
+			if (mymalloc_get_stats(&after))
+			{
+				printf(", %lu splits, %lu merges, %lu quick reuses, %lu merge passes", after.splits - before.splits, after.merges - before.merges,
+						after.quick_reuses - before.quick_reuses, after.merge_passes - before.merge_passes);
+			}
+			printf("\n");
+			exit(0);
+		}
+		else if (pid > 0)
+		{
+			waitpid(pid, NULL, 0);
+		}
+	}
+}
+
+/*
+ * Times allocating and freeing blocks of MYMALLOC_HUGE_THRESHOLD bytes, which each get a mapping of their own, in between 100-byte blocks from the heap.
+ * Prints the mean cost per huge block, and the heap's nodes before and after, which the huge blocks should leave alone.
+ */
+void time_huge()
+{
+	heap_analysis_t before, after;
+	char *small[20];
+	char *huge[20];
+	struct timespec start, end;
+	long huge_blocks = 0;
+	int i, j;
+
+	analyze_heap(&before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 100; i++)
+	{
+		for (j = 0; j < 20; j++)
+		{
+			small[j] = malloc(100);
+			huge[j] = malloc(MYMALLOC_HUGE_THRESHOLD);
+			if (huge[j] != NULL)
+			{
+				huge[j][0] = j;	// touches one page of the mapping
+				huge_blocks++;
+			}
+		}
+		for (j = 0; j < 20; j++)
+		{
+			free(huge[j]);
+			free(small[j]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	analyze_heap(&after);
+
+	double huge_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (huge_blocks > 0 ? huge_blocks : 1);
+	printf("%d-byte blocks: %ld handed out, %8.1f ns per block with its 100-byte neighbour, heap nodes %lu before and %lu after\n",
+			MYMALLOC_HUGE_THRESHOLD, huge_blocks, huge_ns, before.num_nodes, after.num_nodes);
+}
+
+/*
+ * Prints the allocator's counters, if it was built with -DMYMALLOC_STATS.
+ */
+void print_stats()
+{
+	mymalloc_stats_t stats;
+	if (!mymalloc_get_stats(&stats))
+	{
+		return;
+	}
+
+	printf("Live bytes: %zu, peak bytes: %zu\n", stats.live_bytes, stats.peak_bytes);
+	printf("Searches: %lu, nodes traversed: %lu (%.2f per search, at most %lu)\n", stats.searches, stats.nodes_traversed,
+			stats.searches > 0 ? (double) stats.nodes_traversed / stats.searches : 0, stats.max_nodes_traversed);
+	printf("Splits: %lu, merges: %lu, failed mallocs: %lu, failed frees: %lu\n", stats.splits, stats.merges, stats.failed_allocs, stats.failed_frees);
+	printf("Quick reuses: %lu, merge passes: %lu, huge blocks mapped: %lu\n", stats.quick_reuses, stats.merge_passes, stats.huge_maps);
+	printf("Trim passes: %lu, bytes trimmed: %zu\n", stats.trim_passes, stats.trimmed_bytes);
+
+	int i;
+	for (i = 0; i < STATS_NUM_CLASSES; i++)
+	{
+		if (stats.alloc_counts[i] > 0 || stats.free_counts[i] > 0)
+		{
+			printf("Sizes up to %10u: %8lu mallocs, %8lu frees\n", 1U << i, stats.alloc_counts[i], stats.free_counts[i]);
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
+	unsigned int seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;	// rand() starts from 1 unless told otherwise
+
+	compare_policies(seed);
+	trim_spike();
+	compare_batch();
+	compare_arena();
+	compare_heaps();
+	compare_coalescing(seed);
+	time_huge();
+	srand(seed);
+
 	void (*workload_ptr_arr[])() = {workload_a, workload_b, workload_c, workload_d, workload_e, workload_f};
 	double workload_times[100];
 	double workload_avgs[6];
@@ -303,6 +813,8 @@ int main(int argc, char *argv[])
 	}
 
 	print_avg_times(workload_avgs, 6);
+	printf("Build: %-22s total mean runtime of workloads A-F: %f seconds\n", MYMALLOC_BUILD, workload_avgs[0] + workload_avgs[1] + workload_avgs[2] + workload_avgs[3] + workload_avgs[4] + workload_avgs[5]);
+	print_stats();
 
 	return 0;
 }
@@ -0,0 +1,263 @@
+
+#include "mymalloc.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define OPS_PER_THREAD 1000000
+#define SLOTS_PER_THREAD 64
+#define BLOCKS_PER_PAIR 500000
+#define QUEUE_SIZE 1024
+
+/*
+ * Arguments and results of one worker thread.
+ */
+typedef struct worker_t {
+	pthread_t thread;
+	unsigned int seed;	// Seed for rand_r(), so every thread makes its own choices
+	bool own_heap;	// True to allocate from a heap of the thread's own instead of the default heap
+	long ops;	// Number of malloc() and free() calls made
+} worker_t;
+
+/*
+ * A producer thread and a consumer thread, joined by a single-producer, single-consumer ring of blocks.
+ */
+typedef struct pair_t {
+	pthread_t producer;
+	pthread_t consumer;
+	unsigned int seed;	// Seed for rand_r(), so every producer makes its own choices
+	char *queue[QUEUE_SIZE];	// Blocks the producer handed over and the consumer has not freed yet
+	unsigned long head;	// Blocks the producer has put in the queue, only written by the producer
+	unsigned long tail;	// Blocks the consumer has taken out of the queue, only written by the consumer
+} pair_t;
+
+/*
+ * malloc()s BLOCKS_PER_PAIR blocks of 1 to 512 bytes, some small enough for thread caches and some not, and hands each one to the consumer.
+ * @param *arg The thread's pair_t
+ */
+void *producer(void *arg)
+{
+	pair_t *pair = arg;
+	unsigned long head;
+
+	for (head = 0; head < BLOCKS_PER_PAIR; head++)
+	{
+		char *block = malloc(rand_r(&pair->seed) % 512 + 1);
+		block[0] = (char) head;	// touch the memory like a real caller would
+
+		while (head - __atomic_load_n(&pair->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE)	// queue is full
+		{
+			sched_yield();
+		}
+		pair->queue[head % QUEUE_SIZE] = block;
+		__atomic_store_n(&pair->head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/*
+ * free()s every block the producer hands over, on a different thread from the one that malloc()ed it.
+ * @param *arg The thread's pair_t
+ */
+void *consumer(void *arg)
+{
+	pair_t *pair = arg;
+	unsigned long tail;
+
+	for (tail = 0; tail < BLOCKS_PER_PAIR; tail++)
+	{
+		while (__atomic_load_n(&pair->head, __ATOMIC_ACQUIRE) == tail)	// queue is empty
+		{
+			sched_yield();
+		}
+		free(pair->queue[tail % QUEUE_SIZE]);
+		__atomic_store_n(&pair->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs a number of producer and consumer pairs at once.
+ * @param num_pairs Number of pairs to start, each with two threads
+ * @return Throughput across all pairs, in blocks malloc()ed and free()d per second
+ */
+double run_pairs(int num_pairs)
+{
+	static pair_t pairs[MAX_THREADS / 2];
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < num_pairs; i++)
+	{
+		pairs[i].seed = i + 1;
+		pairs[i].head = 0;
+		pairs[i].tail = 0;
+		pthread_create(&pairs[i].producer, NULL, producer, &pairs[i]);
+		pthread_create(&pairs[i].consumer, NULL, consumer, &pairs[i]);
+	}
+	for (i = 0; i < num_pairs; i++)
+	{
+		pthread_join(pairs[i].producer, NULL);
+		pthread_join(pairs[i].consumer, NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double time_elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return (double) num_pairs * BLOCKS_PER_PAIR / time_elapsed;
+}
+
+/*
+ * Randomly choose between a small malloc() and free()ing one of this thread's pointers, OPS_PER_THREAD times.
+ * Every thread works on its own pointers, the same way independent requests in a worker pool would.
+ * With a heap of its own, the thread uses heap_alloc() and heap_free() instead, and destroys the heap at the end.
+ * @param *arg The thread's worker_t
+ */
+void *worker(void *arg)
+{
+	worker_t *self = arg;
+	char *slots[SLOTS_PER_THREAD] = {NULL};
+	heap_t *heap = self->own_heap ? heap_create(1 << 20) : NULL;
+	long i;
+
+	if (self->own_heap && heap == NULL)	// not supported by this build
+	{
+		return NULL;
+	}
+
+	for (i = 0; i < OPS_PER_THREAD; i++)
+	{
+		int slot = rand_r(&self->seed) % SLOTS_PER_THREAD;
+
+		if (slots[slot] == NULL)	// empty slot, malloc() between 1 and 128 bytes
+		{
+			size_t size = rand_r(&self->seed) % 128 + 1;
+			slots[slot] = heap != NULL ? heap_alloc(heap, size) : malloc(size);
+			slots[slot][0] = (char) slot;	// touch the memory like a real caller would
+		}
+		else
+		{
+			if (heap != NULL)
+			{
+				heap_free(heap, slots[slot]);
+			}
+			else
+			{
+				free(slots[slot]);
+			}
+			slots[slot] = NULL;
+		}
+		self->ops++;
+	}
+
+	if (heap != NULL)	// frees all the heap_alloc'ed memory at once
+	{
+		heap_destroy(heap);
+		return NULL;
+	}
+
+	for (i = 0; i < SLOTS_PER_THREAD; i++)	// free all the malloc'ed memory
+	{
+		if (slots[i] != NULL)
+		{
+			free(slots[i]);
+			self->ops++;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs the worker on a number of threads at once.
+ * @param num_threads Number of threads to start
+ * @param own_heap True to give every thread a heap of its own
+ * @return Throughput across all threads, in operations per second
+ */
+double run_threads(int num_threads, bool own_heap)
+{
+	worker_t workers[MAX_THREADS];
+	struct timespec start, end;
+	long total_ops = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < num_threads; i++)
+	{
+		workers[i].seed = i + 1;
+		workers[i].own_heap = own_heap;
+		workers[i].ops = 0;
+		pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+	}
+	for (i = 0; i < num_threads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		total_ops += workers[i].ops;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double time_elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return total_ops / time_elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = argc > 1 ? atoi(argv[1]) : (num_cores < 8 ? 8 : num_cores);
+
+	if (max_threads < 1 || max_threads > MAX_THREADS)
+	{
+		printf("Usage: %s [max threads, 1-%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	mymalloc_init(1 << 20, 256 << 20);	// enough room for every thread's cache
+
+	printf("Cores online: %ld\n", num_cores);
+
+	double base_throughput = 0;
+	int num_threads;
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+	{
+		double throughput = run_threads(num_threads, false);
+		if (num_threads == 1)
+		{
+			base_throughput = throughput;
+		}
+
+		printf("Threads: %2d, throughput: %12.0f ops/sec, speedup: %5.2fx\n", num_threads, throughput, throughput / base_throughput);
+	}
+
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2)	// every thread in a heap of its own, with no lock shared between them
+	{
+		double throughput = run_threads(num_threads, true);
+		if (num_threads == 1)
+		{
+			base_throughput = throughput;
+		}
+
+		printf("Threads with own heaps: %2d, throughput: %12.0f ops/sec, speedup: %5.2fx\n", num_threads, throughput, throughput / base_throughput);
+	}
+
+	int num_pairs;
+	for (num_pairs = 1; num_pairs <= max_threads / 2; num_pairs *= 2)	// blocks malloc()ed on one thread and free()d on another
+	{
+		double throughput = run_pairs(num_pairs);
+		if (num_pairs == 1)
+		{
+			base_throughput = throughput;
+		}
+
+		printf("Producer/consumer pairs: %2d, throughput: %12.0f blocks/sec, speedup: %5.2fx\n", num_pairs, throughput, throughput / base_throughput);
+	}
+
+	return 0;
+}
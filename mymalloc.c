@@ -1,300 +1,3286 @@
 
 #include "mymalloc.h"
+#include "slab.h"
+#include "huge.h"
+#ifdef MYMALLOC_BUDDY
+#include "buddy.h"
+#endif
+#ifdef MYMALLOC_TRACE
+#include "trace.h"
+#endif
+#ifdef MYMALLOC_PROFILE
+#include "profile.h"
+#endif
+#include <sys/mman.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The heap malloc() and friends use, see heap_t.
+ */
+#ifdef MYMALLOC_THREAD_SAFE
+static heap_t default_heap = { .lock = PTHREAD_MUTEX_INITIALIZER };
+#else
+static heap_t default_heap;
+#endif
+
+/*
+ * Heap the calling thread's call works on. Only calls that take a heap handle point it elsewhere, and only until they return.
+ */
+#ifdef MYMALLOC_THREAD_SAFE
+static __thread heap_t *curr_heap = &default_heap;
+#else
+static heap_t *curr_heap = &default_heap;
+#endif
+
+/*
+ * Heaps made by myheap_create() and not yet destroyed, linked through their next field. Protected by the default heap's lock.
+ */
+static heap_t *created_heaps = NULL;
+
+#ifdef MYMALLOC_THREAD_SAFE
+/*
+ * Makes sure the default heap is set up exactly once. Thread caches are private and need no lock.
+ */
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The calling thread's cache, and a key whose destructor flushes it when the thread exits.
+ */
+static __thread thread_cache_t thread_cache;
+static __thread bool thread_cache_registered = false;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Remote free lists of the threads that own blocks, indexed by thread_cache_t.owner. Index 0 is never used.
+ * A list that no thread owns is NULL, and an owned list ends in remote_list_end instead of NULL, so a CAS onto a closed list fails.
+ */
+static cache_entry_t *owned_frees[TCACHE_MAX_OWNERS + 1];
+static cache_entry_t remote_list_end;
+
+/*
+ * Owner of every block of the default heap and the slab area, one byte per OWNER_GRANULE bytes, after the block and slack maps.
+ */
+static uint8_t *owner_map = NULL;
+
+#define lock_heap() (pthread_mutex_lock(&curr_heap->lock), drain_remote_frees())	// whoever takes the lock files the nodes freed while it was held
+#define unlock_heap() pthread_mutex_unlock(&curr_heap->lock)
+#define setup_heap() pthread_once(&heap_once, initialize_malloc)
+#define tag_owner(ptr) (curr_heap == &default_heap && validate_ptr(ptr) ? set_owner(ptr) : (void) 0)	// only blocks of the default heap have owners
+
+/*
+ * Holds the lock of every heap across fork(), so the child never starts with a lock held by a thread it does not have.
+ */
+static void lock_for_fork()
+{
+	heap_t *heap;
+
+	pthread_mutex_lock(&default_heap.lock);	// keeps the list of heaps still
+	for (heap = created_heaps; heap != NULL; heap = heap->next)
+	{
+		pthread_mutex_lock(&heap->lock);
+	}
+}
+
+/*
+ * Releases the lock of every heap in the parent and in the child once fork() returns.
+ */
+static void unlock_after_fork()
+{
+	heap_t *heap;
+
+	for (heap = created_heaps; heap != NULL; heap = heap->next)
+	{
+		pthread_mutex_unlock(&heap->lock);
+	}
+	pthread_mutex_unlock(&default_heap.lock);
+}
+#else
+#define lock_heap()
+#define unlock_heap()
+#define setup_heap() initialize_malloc()
+#define tag_owner(ptr)
+#endif
+
+#ifdef MYMALLOC_TRACE	// only the default heap is traced, replay has no other heaps to replay into
+#define trace_malloc(ptr, size, line, filename) (curr_heap == &default_heap ? trace_record(TRACE_MALLOC, size, ptr, line, filename) : (void) 0)
+#define trace_free(ptr, line, filename) (curr_heap == &default_heap ? trace_record(TRACE_FREE, 0, ptr, line, filename) : (void) 0)
+#else
+#define trace_malloc(ptr, size, line, filename)
+#define trace_free(ptr, line, filename)
+#endif
+
+#ifdef MYMALLOC_PROFILE
+#define profile_malloc(ptr, size, line, filename) profile_record_malloc(ptr, size, line, filename)
+#define profile_free(ptr) profile_record_free(ptr)
+#else
+#define profile_malloc(ptr, size, line, filename)
+#define profile_free(ptr)
+#endif
+
+#ifdef MYMALLOC_DEBUG
+#define guard_block(ptr, usable_size, request_size, line, filename) set_guard(ptr, usable_size, request_size, line, filename)
+#define check_block(ptr, line, filename) check_guard(ptr, line, filename)
+#else
+#define guard_block(ptr, usable_size, request_size, line, filename)
+#define check_block(ptr, line, filename) ((void) (line), (void) (filename))	// callers still take the position for debug builds
+#endif
+
+/*
+ * Start of the default heap, see mymalloc.h.
+ */
+char *myblock = NULL;
+
+/*
+ * Sizes initialize_malloc() will use, as chosen at build time or by mymalloc_init().
+ */
+static size_t initial_heap_size = MYMALLOC_HEAP_SIZE;
+static size_t max_heap_size = MYMALLOC_MAX_HEAP_SIZE;
+
+/*
+ * Placement policy find_free_node() follows, as chosen at build time or by mymalloc_set_policy().
+ */
+static placement_policy policy = MYMALLOC_POLICY;
+
+/*
+ * Whether myfree() defers coalescing, as chosen at build time or by mymalloc_set_deferred_coalescing().
+ */
+static bool defer_coalescing = MYMALLOC_DEFER_COALESCE;
+
+/*
+ * Set once initialize_malloc() has laid out the default heap.
+ */
+static bool heap_initialized = false;
+
+/*
+ * True if the block the calling thread's last mymalloc() handed out started past untouched_index, so mycalloc() need not zero it.
+ */
+#ifdef MYMALLOC_THREAD_SAFE
+static __thread bool last_block_untouched = false;
+#else
+static bool last_block_untouched = false;
+#endif
+
+#ifdef MYMALLOC_STATS
+/*
+ * Counters read by mymalloc_get_stats(), see mymalloc.h.
+ */
+mymalloc_stats_t heap_stats;
+
+/*
+ * Nodes looked at by the calling thread's search in progress. Searches only run with a heap lock held, but each heap has its own.
+ */
+#ifdef MYMALLOC_THREAD_SAFE
+static __thread unsigned long search_nodes = 0;
+#else
+static unsigned long search_nodes = 0;
+#endif
+
+#define stat_node() search_nodes++
+#else
+#define stat_node()
+#endif
 
 /*
  * Creates a new, inactive node.
+ * The node before it is assumed to be active, which holds for the first node and for the leftover half of a split.
  * @param curr_mem_index Current index in memory array
  * @param size Amount of space the node will contain
  */
-void create_node(short curr_mem_index, unsigned short size)
+void create_node(int curr_mem_index, unsigned int size)
+{
+	node_t *new_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+	new_node->size = size;
+	new_node->active = 0;
+	new_node->prev_active = 1;
+}
+
+/*
+ * Chooses the initial and maximum size of the heap, overriding MYMALLOC_HEAP_SIZE and MYMALLOC_MAX_HEAP_SIZE.
+ * Must be called before the first call to mymalloc().
+ * @param initial_size Size of the heap when it is set up, in bytes
+ * @param max_size Size the heap may grow to, in bytes. Pass initial_size to keep the heap from growing.
+ * @return True if the sizes were accepted, false if they are invalid or the heap has already been set up
+ */
+bool mymalloc_init(size_t initial_size, size_t max_size)
+{
+	if (heap_initialized || initial_size < 1 || initial_size > max_size || max_size > HEAP_SIZE_LIMIT)
+	{
+		return false;
+	}
+
+	initial_heap_size = initial_size;
+	max_heap_size = max_size;
+	return true;
+}
+
+/*
+ * Chooses the placement policy, overriding MYMALLOC_POLICY.
+ * Must be called before the first call to mymalloc(), since best fit keeps its bins in a different order.
+ * @param new_policy Placement policy to use
+ * @return True if the policy was accepted, false if it is invalid or the heap has already been set up
+ */
+bool mymalloc_set_policy(placement_policy new_policy)
+{
+	if (heap_initialized || new_policy < 0 || new_policy >= NUM_POLICIES)
+	{
+		return false;
+	}
+
+	policy = new_policy;
+	return true;
+}
+
+/*
+ * Turns deferred coalescing on or off for every heap, overriding MYMALLOC_DEFER_COALESCE. Turning it off merges the quick lists of every heap into it.
+ * @param enabled True to put freed nodes in the quick lists, false to coalesce them as soon as they are freed
+ */
+void mymalloc_set_deferred_coalescing(bool enabled)
+{
+	heap_t *prev_heap = curr_heap;
+	heap_t *heap;
+
+	curr_heap = &default_heap;
+	lock_heap();	// also keeps the list of heaps still
+	defer_coalescing = enabled;
+	if (!enabled)
+	{
+		if (curr_heap->quick_count > 0)
+		{
+			merge_quick_lists();
+		}
+		for (heap = created_heaps; heap != NULL; heap = heap->next)
+		{
+			curr_heap = heap;
+			lock_heap();
+			if (curr_heap->quick_count > 0)
+			{
+				merge_quick_lists();
+			}
+			unlock_heap();
+		}
+		curr_heap = &default_heap;
+	}
+	unlock_heap();
+	curr_heap = prev_heap;
+}
+
+/*
+ * Looks up the name of a placement policy, for reports.
+ * @param policy_id Placement policy
+ * @return Name of the policy
+ */
+const char *get_policy_name(placement_policy policy_id)
+{
+	switch (policy_id)
+	{
+		case POLICY_SEGREGATED_FIT:
+			return "segregated fit";
+		case POLICY_FIRST_FIT:
+			return "first fit";
+		case POLICY_NEXT_FIT:
+			return "next fit";
+		case POLICY_BEST_FIT:
+			return "best fit";
+		default:
+			return "unknown";
+	}
+}
+
+/*
+ * Rounds a size up to a whole number of pages.
+ * @param size Size in bytes
+ * @return Smallest multiple of the page size that is at least size
+ */
+size_t round_to_pages(size_t size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	return (size + page_size - 1) / page_size * page_size;
+}
+
+/*
+ * Determines how many bytes of a reservation a heap's block map takes. Its slack map, right after it, takes as many.
+ * @param reserve_size Bytes reserved for the heap
+ * @return Size of the block map, a whole number of pages
+ */
+size_t get_map_size(size_t reserve_size)
+{
+	return round_to_pages((reserve_size / NODE_ALIGNMENT + 63) / 64 * sizeof(uint64_t));
+}
+
+/*
+ * Lays out an empty heap in curr_heap: empty bins and quick lists, and a single, inactive node encompassing its usable bytes.
+ * @param *block Start of the heap, whose first initial_size bytes are usable and zero
+ * @param initial_size Usable bytes, a whole number of pages
+ * @param max_size Bytes reserved for the heap, a whole number of pages
+ * @param *block_map Zeroed block map covering max_size bytes, followed by a zeroed slack map of the same size
+ */
+void init_heap(char *block, size_t initial_size, size_t max_size, uint64_t *block_map)
+{
+	curr_heap->block = block;
+	curr_heap->heap_size = initial_size;
+	curr_heap->heap_limit = max_size;
+	curr_heap->block_map = block_map;
+	curr_heap->slack_map = block_map + get_map_size(max_size) / sizeof(uint64_t);
+
+	int i;
+	for (i = 0; i < NUM_BINS; i++)
+	{
+		curr_heap->free_bins[i] = -1;
+	}
+	for (i = 0; i < FL_INDEX_COUNT; i++)
+	{
+		curr_heap->sl_bitmap[i] = 0;
+	}
+	for (i = 0; i < DEFER_NUM_BINS; i++)
+	{
+		curr_heap->quick_bins[i] = -1;
+	}
+	curr_heap->fl_bitmap = 0;
+	curr_heap->quick_count = 0;
+	curr_heap->freed_since_trim = 0;
+	curr_heap->slack_bytes = 0;
+	curr_heap->untouched_index = 0;
+
+#ifdef MYMALLOC_BUDDY
+	buddy_init(block, initial_size);
+#else
+	create_node(0, initial_size - sizeof(node_t));
+	insert_free_node(0);
+#endif
+	curr_heap->tail_active = false;
+	curr_heap->next_fit_index = 0;
+}
+
+/*
+ * Sets up the default heap if mymalloc() has not been called previously.
+ * Reserves the maximum heap size and creates a single, inactive node encompassing the initial heap size.
+ * If mymalloc() has been called in the past, nothing will be done.
+ * Every other heap is made after the default heap is set up, so curr_heap is always the default heap here.
+ */
+void initialize_malloc()
+{
+	if (!heap_initialized)
+	{
+		size_t reserve_size = round_to_pages(max_heap_size);
+		size_t usable_size = round_to_pages(initial_heap_size);
+		size_t slab_area_size = round_to_pages(MYMALLOC_SLAB_AREA_SIZE);
+		size_t map_size = get_map_size(reserve_size);
+		size_t maps_size = 2 * map_size;
+#ifdef MYMALLOC_THREAD_SAFE
+		maps_size += round_to_pages((reserve_size + slab_area_size) / OWNER_GRANULE);	// the owner map follows the block and slack maps
+#endif
+
+		// reserve address space for the largest heap followed by the slab area and the maps, but only make the initial heap usable
+		char *reservation = mmap(NULL, reserve_size + slab_area_size + maps_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (reservation == MAP_FAILED)
+		{
+			return;
+		}
+		if (mprotect(reservation, usable_size, PROT_READ | PROT_WRITE) != 0
+				|| mprotect(reservation + reserve_size, slab_area_size + maps_size, PROT_READ | PROT_WRITE) != 0)	// slab and map pages only take memory once touched
+		{
+			munmap(reservation, reserve_size + slab_area_size + maps_size);
+			return;
+		}
+
+		myblock = reservation;
+		slab_init(reservation + reserve_size, slab_area_size);
+		init_heap(reservation, usable_size, reserve_size, (uint64_t*) (reservation + reserve_size + slab_area_size));
+#ifdef MYMALLOC_THREAD_SAFE
+		owner_map = (uint8_t*) (reservation + reserve_size + slab_area_size + 2 * map_size);
+		pthread_atfork(lock_for_fork, unlock_after_fork, unlock_after_fork);
+#endif
+		heap_initialized = true;
+	}
+}
+
+/*
+ * Makes another region of the reservation usable and adds it to the end of the heap as an inactive node.
+ * The new node is merged with the last node of the old heap if that node is inactive.
+ * The region is at least MYMALLOC_REGION_SIZE, and at least large enough for the request, unless that would pass the maximum heap size.
+ * @param request_size Amount of space that could not be found in the current heap
+ * @return True if the heap grew, false if it is already at its maximum size
+ */
+bool grow_heap(unsigned int request_size)
+{
+	size_t grow_size = round_to_pages(request_size + sizeof(node_t));
+
+	if (grow_size < MYMALLOC_REGION_SIZE)
+	{
+		grow_size = round_to_pages(MYMALLOC_REGION_SIZE);
+	}
+	if (grow_size > curr_heap->heap_limit - curr_heap->heap_size)	// use whatever is left of the reservation
+	{
+		grow_size = curr_heap->heap_limit - curr_heap->heap_size;
+	}
+	if (grow_size == 0 || mprotect(curr_heap->block + curr_heap->heap_size, grow_size, PROT_READ | PROT_WRITE) != 0)
+	{
+		return false;
+	}
+
+	int new_mem_index = curr_heap->heap_size;
+	curr_heap->heap_size += grow_size;
+
+#ifdef MYMALLOC_BUDDY
+	buddy_grow(curr_heap->heap_size);
+	return true;
+#endif
+
+	create_node(new_mem_index, grow_size - sizeof(node_t));
+	((node_t*) &curr_heap->block[new_mem_index])->prev_active = curr_heap->tail_active;
+	curr_heap->tail_active = false;
+
+	combine_nodes(get_prev_index(new_mem_index), new_mem_index, -1);	// old last node may be inactive
+	return true;
+}
+
+/*
+ * Determines whether or not the space requested by the user is a valid request.
+ * The user can request a minimum of 1 byte.
+ * The maximal request is determined by subtracting the size of one metadata node from the size of the memory array.
+ * Requests that round up to at least MYMALLOC_HUGE_THRESHOLD bytes from the default heap get a mapping of their own instead, so they are only limited by PTRDIFF_MAX.
+ * Both limits apply to the request once round_request() has rounded it, as that is the size the block is taken with.
+ * @param request_size Amount of bytes requested by the user
+ * @return True if the request is valid, and false otherwise
+ */
+bool validate_request(size_t request_size, int line, char* filename)
+{
+	size_t size = request_size <= PTRDIFF_MAX ? round_request(request_size) : request_size;	// the size allocate_block() routes on, rounding anything larger could wrap around
+	size_t max_request = size >= MYMALLOC_HUGE_THRESHOLD && curr_heap == &default_heap ? PTRDIFF_MAX : curr_heap->heap_limit - sizeof(node_t);
+
+	if (request_size < 1)	// checking if request is too small
+	{
+		report_error("Error at line %d in file %s: Request is too small! Minimum request: %d; your request: %zu\n", line, filename, 1, request_size);
+		return false;
+	}
+	else if (size > max_request) 	// check if the request is too big
+	{
+
+		report_error("Error at line %d in file %s: Request is too large! Maximum request: %zu; your request: %zu\n", line, filename, max_request, request_size);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Determines which bin an inactive node of a given size belongs to.
+ * @param size Size of the node
+ * @return Index of the bin
+ */
+int get_bin(unsigned int size)
+{
+	if (size < SMALL_NODE_SIZE)	// small sizes each get their own bin
+	{
+		return size / (SMALL_NODE_SIZE / SL_INDEX_COUNT);
+	}
+
+	int fl = 31 - __builtin_clz(size);	// position of the highest set bit
+	int sl = (size >> (fl - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;	// next SL_INDEX_COUNT_LOG2 bits below it
+
+	return (fl - FL_INDEX_SHIFT + 1) * SL_INDEX_COUNT + sl;
+}
+
+/*
+ * Determines the first bin whose nodes are all large enough for a request.
+ * The request is rounded up to the start of the next bin, so any node found there fits without comparing sizes.
+ * @param request_size Amount of space requested
+ * @return Index of the bin, or NUM_BINS if no bin is guaranteed to fit
+ */
+int get_search_bin(unsigned int request_size)
+{
+	if (request_size >= SMALL_NODE_SIZE)
+	{
+		request_size += (1 << (31 - __builtin_clz(request_size) - SL_INDEX_COUNT_LOG2)) - 1;
+	}
+
+	if (request_size >= HEAP_SIZE_LIMIT)	// larger than any node
+	{
+		return NUM_BINS;
+	}
+
+	return get_bin(request_size);
+}
+
+/*
+ * Returns the free links stored in the data section of an inactive node, or in its header in aligned layout mode.
+ * @param curr_mem_index Index of the inactive node
+ * @return Pointer to the node's free links
+ */
+free_links_t *get_links(int curr_mem_index)
+{
+#ifdef MYMALLOC_ALIGN16
+	return &((node_t*) &curr_heap->block[curr_mem_index])->links;
+#else
+	return (free_links_t*) &curr_heap->block[curr_mem_index + sizeof(node_t)];
+#endif
+}
+
+/*
+ * Writes the boundary tag of an inactive node.
+ * @param curr_mem_index Index of the inactive node
+ */
+void set_footer(int curr_mem_index)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	footer_t *footer = (footer_t*) &curr_heap->block[curr_mem_index + sizeof(node_t) + curr_node->size - sizeof(footer_t)];
+
+	*footer = curr_node->size;
+}
+
+/*
+ * Adds an inactive node to the front of the bin for its size, and marks the bin as non-empty.
+ * Under best fit, the node is instead inserted before the first node of the bin that is at least as large.
+ * Also writes the node's boundary tag, since every inactive node is in a bin.
+ * @param curr_mem_index Index of the inactive node
+ */
+void insert_free_node(int curr_mem_index)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	free_links_t *links = get_links(curr_mem_index);
+	int bin = get_bin(curr_node->size);
+	int prev_mem_index = -1;
+	int next_mem_index = curr_heap->free_bins[bin];
+
+	set_footer(curr_mem_index);
+
+	if (policy == POLICY_BEST_FIT)	// keep the bin sorted by size
+	{
+		while (next_mem_index > -1 && ((node_t*) &curr_heap->block[next_mem_index])->size < curr_node->size)
+		{
+			prev_mem_index = next_mem_index;
+			next_mem_index = get_links(next_mem_index)->next_index;
+		}
+	}
+
+	links->prev_index = prev_mem_index;
+	links->next_index = next_mem_index;
+
+	if (next_mem_index > -1)	// that node now comes after this one
+	{
+		get_links(next_mem_index)->prev_index = curr_mem_index;
+	}
+
+	if (prev_mem_index > -1)
+	{
+		get_links(prev_mem_index)->next_index = curr_mem_index;
+	}
+	else	// node is the new head of its bin
+	{
+		curr_heap->free_bins[bin] = curr_mem_index;
+	}
+	curr_heap->fl_bitmap |= 1U << (bin / SL_INDEX_COUNT);
+	curr_heap->sl_bitmap[bin / SL_INDEX_COUNT] |= 1U << (bin % SL_INDEX_COUNT);
+}
+
+/*
+ * Unlinks an inactive node from its bin, and marks the bin as empty if it was the last node.
+ * Must be called before the node is activated, resized or absorbed by another node.
+ * @param curr_mem_index Index of the inactive node
+ */
+void remove_free_node(int curr_mem_index)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	free_links_t *links = get_links(curr_mem_index);
+
+	if (links->prev_index > -1)
+	{
+		get_links(links->prev_index)->next_index = links->next_index;
+	}
+	else	// node was the head of its bin
+	{
+		int bin = get_bin(curr_node->size);
+		curr_heap->free_bins[bin] = links->next_index;
+
+		if (curr_heap->free_bins[bin] < 0)	// bin is now empty
+		{
+			curr_heap->sl_bitmap[bin / SL_INDEX_COUNT] &= ~(1U << (bin % SL_INDEX_COUNT));
+			if (curr_heap->sl_bitmap[bin / SL_INDEX_COUNT] == 0)
+			{
+				curr_heap->fl_bitmap &= ~(1U << (bin / SL_INDEX_COUNT));
+			}
+		}
+	}
+
+	if (links->next_index > -1)
+	{
+		get_links(links->next_index)->prev_index = links->prev_index;
+	}
+}
+
+/*
+ * Finds an inactive node that can hold the requested amount of space, as chosen by the placement policy.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_free_node(unsigned int request_size)
+{
+	int curr_mem_index;
+
+	switch (policy)
+	{
+		case POLICY_FIRST_FIT:
+			curr_mem_index = find_first_fit(0, -1, request_size);
+			break;
+		case POLICY_NEXT_FIT:
+			curr_mem_index = find_next_fit(request_size);
+			break;
+		case POLICY_BEST_FIT:
+			curr_mem_index = find_best_fit(request_size);
+			break;
+		default:
+			curr_mem_index = find_segregated_fit(request_size);
+			break;
+	}
+
+	stat_search();
+	return curr_mem_index;
+}
+
+/*
+ * Finds the first non-empty bin at or after a given bin, using the bitmaps.
+ * @param bin Index of the bin to start from
+ * @return Index of the bin, or NUM_BINS if every bin from there on is empty
+ */
+int find_next_bin(int bin)
+{
+	if (bin >= NUM_BINS)
+	{
+		return NUM_BINS;
+	}
+
+	int fl = bin / SL_INDEX_COUNT;
+	unsigned int sl_map = curr_heap->sl_bitmap[fl] & (~0U << (bin % SL_INDEX_COUNT));	// non-empty bins at or after bin, within fl
+
+	if (sl_map == 0)	// nothing left within fl, move to the next non-empty first-level index
+	{
+		unsigned int fl_map = fl + 1 < 32 ? curr_heap->fl_bitmap & (~0U << (fl + 1)) : 0;
+		if (fl_map == 0)
+		{
+			return NUM_BINS;
+		}
+
+		fl = __builtin_ctz(fl_map);
+		sl_map = curr_heap->sl_bitmap[fl];
+	}
+
+	return fl * SL_INDEX_COUNT + __builtin_ctz(sl_map);
+}
+
+/*
+ * Segregated fit: finds the first node of the first non-empty bin at or after get_search_bin(), which always fits.
+ * Only if there is no such bin is the request's own bin searched, since it may still hold a node that is large enough.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_segregated_fit(unsigned int request_size)
+{
+	int bin = find_next_bin(get_search_bin(request_size));
+
+	if (bin < NUM_BINS)
+	{
+		stat_node();
+		return curr_heap->free_bins[bin];
+	}
+
+	int curr_mem_index = curr_heap->free_bins[get_bin(request_size)];
+	while (curr_mem_index > -1)	// last resort, first fit within the request's own bin
+	{
+		stat_node();
+		if (compare(curr_mem_index, request_size) != ACTION_SKIP)
+		{
+			return curr_mem_index;
+		}
+		curr_mem_index = get_links(curr_mem_index)->next_index;
+	}
+
+	return -1;
+}
+
+/*
+ * First fit: walks the heap from its start, and finds the first inactive node that fits.
+ * @param start_index Index of the node to start walking from
+ * @param end_index Index to stop walking at, or -1 to walk to the end of the heap
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_first_fit(int start_index, int end_index, unsigned int request_size)
+{
+	int curr_mem_index = start_index;
+
+	while (curr_mem_index > -1 && curr_mem_index != end_index)
+	{
+		stat_node();
+		if (!((node_t*) &curr_heap->block[curr_mem_index])->active && compare(curr_mem_index, request_size) != ACTION_SKIP)
+		{
+			return curr_mem_index;
+		}
+		curr_mem_index = get_next_index(curr_mem_index);
+	}
+
+	return -1;
+}
+
+/*
+ * Next fit: walks the heap from the node the last search ended at, wrapping around to the start of the heap.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_next_fit(unsigned int request_size)
+{
+	int curr_mem_index = find_first_fit(curr_heap->next_fit_index, -1, request_size);
+
+	if (curr_mem_index < 0 && curr_heap->next_fit_index > 0)	// wrap around, and walk up to where this search started
+	{
+		curr_mem_index = find_first_fit(0, curr_heap->next_fit_index, request_size);
+	}
+
+	if (curr_mem_index > -1)
+	{
+		curr_heap->next_fit_index = curr_mem_index;
+	}
+
+	return curr_mem_index;
+}
+
+/*
+ * Best fit: finds the smallest inactive node that fits.
+ * Bins are sorted by size, so the first node that fits in the request's own bin is the best one in it,
+ * and otherwise the first node of the next non-empty bin is.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_best_fit(unsigned int request_size)
+{
+	int bin = get_bin(request_size);
+	int curr_mem_index = curr_heap->free_bins[bin];
+
+	while (curr_mem_index > -1)
+	{
+		stat_node();
+		if (compare(curr_mem_index, request_size) != ACTION_SKIP)
+		{
+			return curr_mem_index;
+		}
+		curr_mem_index = get_links(curr_mem_index)->next_index;
+	}
+
+	bin = find_next_bin(bin + 1);
+	if (bin < NUM_BINS)
+	{
+		stat_node();
+		return curr_heap->free_bins[bin];
+	}
+
+	return -1;
+}
+
+/*
+ * Calculates and returns the index of the next metadata node.
+ * @param curr_mem_index Index in the memory array from which to begin counting
+ * @return Index of the next metadata node
+ */
+int get_next_index(int curr_mem_index)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+	int next_mem_index = curr_mem_index + curr_node->size + sizeof(node_t);	// calculate location of next node
+
+	if (next_mem_index >= (int) (curr_heap->heap_size - sizeof(node_t))) // out of bounds!
+	{
+		return -1;
+	}
+
+	return next_mem_index;
+}
+
+/*
+ * Calculates the index of the previous metadata node using its boundary tag.
+ * Only inactive nodes carry a boundary tag, so this only finds the previous node if it can be merged with.
+ * @param curr_mem_index Index of the current node
+ * @return Index of the previous node if it is inactive, and -1 otherwise
+ */
+int get_prev_index(int curr_mem_index)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+	if (curr_node->prev_active)	// previous node is active or does not exist, it has no boundary tag
+	{
+		return -1;
+	}
+
+	footer_t *prev_footer = (footer_t*) &curr_heap->block[curr_mem_index - (int) sizeof(footer_t)];
+	return curr_mem_index - *prev_footer - sizeof(node_t);
+}
+
+/*
+ * Activates or deactivates a node, keeping the prev_active flag of the node after it in sync.
+ * @param curr_mem_index Index of the node
+ * @param active Whether the node should be active
+ */
+void set_active(int curr_mem_index, bool active)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	int next_mem_index = get_next_index(curr_mem_index);
+
+	curr_node->active = active;
+
+	if (next_mem_index > -1)
+	{
+		((node_t*) &curr_heap->block[next_mem_index])->prev_active = active;
+	}
+	else	// last node of the heap
+	{
+		curr_heap->tail_active = active;
+	}
+}
+
+/*
+ * Compares the current inactive node with the amount of requested space and determines an action.
+ * @param curr_mem_index Index of the current node
+ * @param request_size Amount of space requested
+ * @return The first action that should be taken on the current node
+ */
+action_type compare(int curr_mem_index, unsigned int request_size)
+{
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	action_type result = ACTION_SKIP;
+
+	if (curr_node->size < request_size)	// node is too small
+	{
+		result = ACTION_SKIP;
+	}
+	else if (curr_node->size < request_size + sizeof(node_t) + MIN_PAYLOAD_SIZE)	// node can accomodate requested data, but the leftover space could not hold an inactive node
+	{
+		result = ACTION_FILL;
+	}
+	else	// Node can accomodate data and has enough leftover space to birth a new, unused node
+	{
+		result = ACTION_SPLIT;
+	}
+
+	return result;
+}
+
+/*
+ * Splits a large node into two.
+ * The first node is created with a specified size.
+ * The second node is created out of the remaining space from the original node.
+ * @param curr_mem_index Index of the large node that will be split
+ * @param request_size Desired size of first node
+ */
+void split_node(int curr_mem_index, unsigned int request_size)
+{
+	node_t *first_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+	unsigned int second_size = first_node->size - sizeof(node_t) - request_size;	// calculates size of second node from what will be left over after forming first node
+
+	first_node->size = request_size;	// assigns first node its requested size
+	int second_node_index = get_next_index(curr_mem_index);	// sets the second node to begin at what is now unused memory
+	create_node(second_node_index, second_size);	// creates the second node, allowing you to navigate past it in the future
+	insert_free_node(second_node_index);	// leftover space can be handed out by a later request
+	stat_add(splits, 1);
+}
+
+/*
+ * Returns a void pointer to the beginning of the user data associated with a metadata node.
+ * @param curr_mem_index Index of the metadata node
+ * @return Void pointer to user data
+ */
+void *get_data_ptr (int curr_mem_index)
+{
+	void *data_ptr = (void*) &curr_heap->block[curr_mem_index + sizeof(node_t)];
+	return data_ptr;
+}
+
+
+/*
+ * Takes a node of the requested size from the heap, growing the heap if no node fits.
+ * In buddy system mode the node is a buddy block instead, see buddy.h.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Amount of space requested, already rounded by mymalloc()
+ * @return Pointer to the node's data, or NULL if the heap is out of memory
+ */
+void *allocate_from_heap(unsigned int request_size)
+{
+	if (curr_heap->quick_count > 0)	// a node of exactly this size may have been freed recently
+	{
+		int quick_index = take_quick_node(request_size);
+		if (quick_index > -1)
+		{
+			stat_add(quick_reuses, 1);
+			last_block_untouched = false;
+			return get_data_ptr(quick_index);
+		}
+	}
+
+#ifdef MYMALLOC_BUDDY
+	int block_index = buddy_alloc(request_size);
+	if (block_index < 0 && curr_heap->quick_count > 0)	// merging the quick lists may free a block that fits
+	{
+		merge_quick_lists();
+		block_index = buddy_alloc(request_size);
+	}
+	while (block_index < 0 && grow_heap(request_size))	// no block fits, add another region to the heap
+	{
+		block_index = buddy_alloc(request_size);
+	}
+
+	if (block_index < 0)
+	{
+		return NULL;
+	}
+
+	add_slack(block_index, request_size);
+	return get_data_ptr(block_index);
+#endif
+
+	int curr_mem_index = find_free_node(request_size);
+	if (curr_mem_index < 0 && curr_heap->quick_count > 0)	// nodes in the quick lists may merge into one that fits
+	{
+		merge_quick_lists();
+		curr_mem_index = find_free_node(request_size);
+	}
+	while (curr_mem_index < 0 && grow_heap(request_size))	// no node fits, add another region to the heap
+	{
+		curr_mem_index = find_free_node(request_size);
+	}
+
+	if (curr_mem_index > -1)
+	{
+		remove_free_node(curr_mem_index);	// node is about to be filled, take it out of its bin
+
+		action_type action = compare(curr_mem_index, request_size);
+		if (action == ACTION_FILL)	// leftover space stays in the node, unused
+		{
+			add_slack(curr_mem_index, request_size);
+		}
+
+		switch (action)
+		{
+			case ACTION_SPLIT:
+				split_node(curr_mem_index, request_size);	// fall through - the front of the node is filled
+			case ACTION_FILL:
+				set_active(curr_mem_index, 1);
+				last_block_untouched = claim_untouched(curr_mem_index);
+				return get_data_ptr(curr_mem_index);
+			case ACTION_SKIP:	// find_free_node() only returns nodes that fit
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Moves untouched_index past a node that is being handed out, since the user may write anywhere in it.
+ * @param curr_mem_index Index of the node
+ * @return True if the node's data started at or past untouched_index, so it only holds zeros and the node's old free links and boundary tag
+ */
+bool claim_untouched(int curr_mem_index)
+{
+	int data_index = curr_mem_index + sizeof(node_t);
+	int end_index = data_index + ((node_t*) &curr_heap->block[curr_mem_index])->size;
+	bool untouched = data_index >= curr_heap->untouched_index;
+
+	if (end_index > curr_heap->untouched_index)
+	{
+		curr_heap->untouched_index = end_index;
+	}
+
+	return untouched;
+}
+
+/*
+ * Counts the bytes of an active node beyond the request it was handed out for, and marks where the request ends in the slack map,
+ * so remove_slack() can take them off the count again once the node is freed or resized.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of the node
+ * @param request_size Size the node was handed out for, rounded like mymalloc() rounds requests
+ */
+void add_slack(int curr_mem_index, unsigned int request_size)
+{
+	unsigned int size = ((node_t*) &curr_heap->block[curr_mem_index])->size;
+
+	if (size > request_size)
+	{
+		size_t mark = (curr_mem_index + sizeof(node_t) + request_size) / NODE_ALIGNMENT;
+		curr_heap->slack_map[mark / 64] |= 1ULL << (mark % 64);
+		curr_heap->slack_bytes += size - request_size;
+	}
+}
+
+/*
+ * Takes the slack of an active node off the count and clears its mark, if add_slack() counted any.
+ * Filled nodes never keep more slack than a header and the smallest payload, so only that far back from the end of the node is searched.
+ * Buddy blocks may keep up to half their size, and are searched whole.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of the node
+ */
+void remove_slack(int curr_mem_index)
+{
+	size_t data_index = curr_mem_index + sizeof(node_t);
+	size_t first = data_index / NODE_ALIGNMENT + 1;	// every request takes at least the first NODE_ALIGNMENT bytes
+	size_t end = (data_index + ((node_t*) &curr_heap->block[curr_mem_index])->size) / NODE_ALIGNMENT;
+
+#ifndef MYMALLOC_BUDDY
+	if (end - first > (sizeof(node_t) + MIN_PAYLOAD_SIZE) / NODE_ALIGNMENT)
+	{
+		first = end - (sizeof(node_t) + MIN_PAYLOAD_SIZE) / NODE_ALIGNMENT;
+	}
+#endif
+
+	size_t i;
+	for (i = first; i < end; i = (i | 63) + 1)	// one word of the map at a time
+	{
+		uint64_t bits = curr_heap->slack_map[i / 64] >> (i % 64);
+		if (end - i < 64)
+		{
+			bits &= (1ULL << (end - i)) - 1;	// drops marks past the end of the node
+		}
+		if (bits != 0)
+		{
+			size_t mark = i + __builtin_ctzll(bits);
+			curr_heap->slack_map[mark / 64] &= ~(1ULL << (mark % 64));
+			curr_heap->slack_bytes -= (end - mark) * NODE_ALIGNMENT;
+			return;
+		}
+	}
+}
+
+/*
+ * Gives the end of an active node back to the heap as an inactive node, if the node is large enough to split.
+ * The new node is merged with the node after it if that node is inactive.
+ * @param curr_mem_index Index of the active node
+ * @param request_size Size the node should keep, rounded like mymalloc() rounds requests
+ */
+void trim_node(int curr_mem_index, unsigned int request_size)
+{
+	if (compare(curr_mem_index, request_size) != ACTION_SPLIT)	// leftover space could not hold an inactive node
+	{
+		return;
+	}
+
+	split_node(curr_mem_index, request_size);
+
+	int leftover_index = get_next_index(curr_mem_index);
+	remove_free_node(leftover_index);	// split_node() filed it before knowing its neighbours
+	set_active(leftover_index, 0);	// node after it may still think an active node is in front of it
+	combine_nodes(-1, leftover_index, get_next_index(leftover_index));
+}
+
+/*
+ * Returns an active node to the heap, merging it with inactive neighbours.
+ * In buddy system mode the node is a buddy block, and is merged with its buddy instead.
+ * Once MYMALLOC_TRIM_THRESHOLD bytes have been returned since the last trim, the heap is trimmed.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of a validated, active node
+ */
+void release_to_heap(int curr_mem_index)
+{
+	remove_slack(curr_mem_index);
+	curr_heap->freed_since_trim += sizeof(node_t) + ((node_t*) &curr_heap->block[curr_mem_index])->size;
+
+#ifdef MYMALLOC_BUDDY
+	buddy_free(curr_mem_index);
+#else
+	set_active(curr_mem_index, 0);	// set inactive - do not need to clear out data
+	combine_nodes(get_prev_index(curr_mem_index), curr_mem_index, get_next_index(curr_mem_index)); // check adjacent nodes
+#endif
+
+	if (MYMALLOC_TRIM_THRESHOLD > 0 && curr_heap->freed_since_trim >= MYMALLOC_TRIM_THRESHOLD)
+	{
+		trim_heap();
+	}
+}
+
+/*
+ * Gives the whole pages inside an inactive node's data section back to the operating system. They read as zero the next time they are touched.
+ * The free links at the start of the data section and the boundary tag at its end stay where they are.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of an inactive node
+ * @return Bytes given back
+ */
+size_t release_node_pages(int curr_mem_index)
+{
+	uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t) &curr_heap->block[curr_mem_index + sizeof(node_t) + sizeof(free_links_t)];
+	uintptr_t end = (uintptr_t) &curr_heap->block[curr_mem_index + sizeof(node_t) + ((node_t*) &curr_heap->block[curr_mem_index])->size - sizeof(footer_t)];
+
+	start = (start + page_size - 1) & ~(page_size - 1);
+	end &= ~(page_size - 1);
+	if (end <= start || madvise((void*) start, end - start, MADV_DONTNEED) != 0)
+	{
+		return 0;
+	}
+
+	return end - start;
+}
+
+/*
+ * Gives the whole pages inside every inactive node back to the operating system, so the heap's resident memory follows what is handed out.
+ * Nodes smaller than a page are skipped, since they cannot hold a whole page. In buddy system mode every block is looked at instead.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @return Bytes given back. Pages given back by an earlier trim and not touched since are counted again.
+ */
+size_t trim_heap()
+{
+	size_t released = 0;
+	int curr_mem_index;
+
+#ifdef MYMALLOC_BUDDY
+	for (curr_mem_index = 0; curr_mem_index > -1; curr_mem_index = get_next_index(curr_mem_index))
+	{
+		if (!((node_t*) &curr_heap->block[curr_mem_index])->active)
+		{
+			released += release_node_pages(curr_mem_index);
+		}
+	}
+#else
+	int bin;
+	for (bin = get_bin(sysconf(_SC_PAGESIZE)); bin < NUM_BINS; bin++)
+	{
+		for (curr_mem_index = curr_heap->free_bins[bin]; curr_mem_index > -1; curr_mem_index = get_links(curr_mem_index)->next_index)
+		{
+			released += release_node_pages(curr_mem_index);
+		}
+	}
+#endif
+
+	curr_heap->freed_since_trim = 0;
+	stat_add(trim_passes, 1);
+	stat_add(trimmed_bytes, released);
+	return released;
+}
+
+/*
+ * Gives the memory of inactive nodes back to the operating system now, instead of waiting for MYMALLOC_TRIM_THRESHOLD bytes to be freed.
+ * Nodes in the quick lists are merged into the heap first.
+ * @return Bytes given back
+ */
+size_t mymalloc_trim()
+{
+	if (curr_heap->block == NULL)
+	{
+		return 0;
+	}
+
+	lock_heap();
+	if (curr_heap->quick_count > 0)
+	{
+		merge_quick_lists();
+	}
+	size_t released = trim_heap();
+	unlock_heap();
+
+	return released;
+}
+
+/*
+ * Determines which quick list holds nodes of a given size.
+ * @param size Node size
+ * @return Index of the list, or -1 if nodes of this size are coalesced as soon as they are freed
+ */
+int get_quick_bin(unsigned int size)
+{
+	if (size > DEFER_MAX_SIZE)
+	{
+		return -1;
+	}
+
+	return size / NODE_ALIGNMENT - 1;
+}
+
+/*
+ * Frees a node. With deferred coalescing on, the node stays active and goes on the quick list for its size instead of being merged with its neighbours.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of a validated, active node
+ */
+void free_node(int curr_mem_index)
+{
+#ifdef MYMALLOC_BUDDY
+	int quick_bin = -1;	// buddy blocks are powers of two and rounded requests are not, so no request would ever take one back
+#else
+	int quick_bin = defer_coalescing ? get_quick_bin(((node_t*) &curr_heap->block[curr_mem_index])->size) : -1;
+#endif
+
+	if (quick_bin < 0)
+	{
+		release_to_heap(curr_mem_index);
+		return;
+	}
+
+	remove_slack(curr_mem_index);	// the next request takes the node at exactly its size
+	get_links(curr_mem_index)->next_index = curr_heap->quick_bins[quick_bin];
+	curr_heap->quick_bins[quick_bin] = curr_mem_index;
+	curr_heap->quick_count++;
+
+	if (curr_heap->quick_count >= DEFER_MAX_BLOCKS)
+	{
+		merge_quick_lists();
+	}
+}
+
+/*
+ * Takes a node off the quick list for a size.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Node size wanted, already rounded by mymalloc()
+ * @return Index of an active node of exactly that size, or -1 if the list is empty
+ */
+int take_quick_node(unsigned int request_size)
+{
+	int quick_bin = get_quick_bin(request_size);
+	if (quick_bin < 0 || curr_heap->quick_bins[quick_bin] < 0)
+	{
+		return -1;
+	}
+
+	int curr_mem_index = curr_heap->quick_bins[quick_bin];
+	curr_heap->quick_bins[quick_bin] = get_links(curr_mem_index)->next_index;
+	curr_heap->quick_count--;
+	return curr_mem_index;
+}
+
+/*
+ * Returns every node in the quick lists to the heap, merging each with its inactive neighbours, including nodes returned before it.
+ * In thread-safe mode the caller must hold the heap lock.
+ */
+void merge_quick_lists()
+{
+	int i;
+
+	for (i = 0; i < DEFER_NUM_BINS; i++)
+	{
+		while (curr_heap->quick_bins[i] > -1)
+		{
+			int curr_mem_index = curr_heap->quick_bins[i];
+			curr_heap->quick_bins[i] = get_links(curr_mem_index)->next_index;	// release_to_heap() reuses the links
+			release_to_heap(curr_mem_index);
+		}
+	}
+
+	curr_heap->quick_count = 0;
+	stat_add(merge_passes, 1);
+}
+
+/*
+ * Takes a block for a rounded request, from a slab if the request is tiny, from a mapping of its own if it is huge, and from the heap otherwise.
+ * Tiny requests fall back to the heap when the slab area is full. Heaps other than the default heap always take a node.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Amount of space requested, already rounded by mymalloc()
+ * @return Pointer to the block, or NULL if there is no memory left
+ */
+void *allocate_block(size_t request_size)
+{
+	if (curr_heap != &default_heap)	// slots and mappings lie outside the heap, so they would outlive it
+	{
+		return allocate_from_heap(request_size < MIN_PAYLOAD_SIZE ? MIN_PAYLOAD_SIZE : request_size);
+	}
+
+	if (request_size >= MYMALLOC_HUGE_THRESHOLD)	// never searches the heap, and leaves no hole in it once freed
+	{
+		void *huge_ptr = huge_alloc(request_size);
+		if (huge_ptr != NULL)
+		{
+			stat_add(huge_maps, 1);
+		}
+		return huge_ptr;
+	}
+
+	if (request_size <= SLAB_MAX_SIZE)
+	{
+		void *slot_ptr = slab_alloc(request_size);
+		if (slot_ptr != NULL)
+		{
+			return slot_ptr;
+		}
+
+		if (request_size < MIN_PAYLOAD_SIZE)	// node must be able to hold its free links once it is freed
+		{
+			request_size = MIN_PAYLOAD_SIZE;
+		}
+	}
+
+	return allocate_from_heap(request_size);
+}
+
+/*
+ * Returns a validated block to the slab, node or mapping it came from.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer to a block that is handed out
+ */
+void release_block(void *ptr)
+{
+	if (slab_owns(ptr))
+	{
+		slab_free(ptr);
+	}
+	else if (validate_ptr(ptr))
+	{
+		release_to_heap((int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t));
+	}
+	else
+	{
+		huge_free(ptr);
+	}
+}
+
+/*
+ * Rounds a valid request up to the size of the slot or node that will hold it.
+ * In debug builds the block also holds the request's guard.
+ * @param request_size Amount of bytes requested by the user
+ * @return Size of the block to take
+ */
+size_t round_request(size_t request_size)
+{
+#ifdef MYMALLOC_DEBUG
+	request_size += GUARD_SIZE;
+#endif
+
+#ifdef MYMALLOC_THREAD_SAFE
+	if (request_size < sizeof(cache_entry_t))	// block must be able to hold its link while it sits in a thread cache
+	{
+		request_size = sizeof(cache_entry_t);
+	}
+#endif
+
+	if (request_size <= SLAB_MAX_SIZE)	// tiny request, round up to the size of a slot
+	{
+		return (slab_class(request_size) + 1) * SLAB_QUANTUM;
+	}
+
+	return (request_size + NODE_ALIGNMENT - 1) & ~(NODE_ALIGNMENT - 1);	// keeps every node, and its boundary tag, aligned
+}
+
+#ifdef MYMALLOC_DEBUG
+/*
+ * Writes a block's guard: canary bytes from the end of the request up to the guard record at the end of the block.
+ * Writing the guard also means mycalloc() can no longer assume the block is untouched.
+ * @param *ptr Block that is being handed out
+ * @param usable_size Usable size of the block, at least request_size + GUARD_SIZE
+ * @param request_size Bytes the user asked for
+ */
+void set_guard(void *ptr, size_t usable_size, size_t request_size, int line, char* filename)
+{
+	guard_t guard = {request_size, line, filename};
+
+	memset((char*) ptr + request_size, CANARY_BYTE, usable_size - sizeof(guard_t) - request_size);
+	memcpy((char*) ptr + usable_size - sizeof(guard_t), &guard, sizeof(guard_t));	// the end of a block is only 4-byte aligned
+	last_block_untouched = false;
+}
+
+/*
+ * Checks that nothing was written past the end of a block, and reports the call that allocated it if something was.
+ * The guard is written again after a report, so an overrun is only reported once.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer other than NULL
+ * @return True if the guard is intact or ptr is not a block that is handed out, false if the block was written past its end
+ */
+bool check_guard(void *ptr, int line, char* filename)
+{
+	size_t usable_size = get_usable_size(ptr);
+	if (usable_size == 0)	// not handed out, the caller reports that
+	{
+		return true;
+	}
+
+	unsigned char *canary = (unsigned char*) ptr;
+	size_t guard_index = usable_size - sizeof(guard_t);
+	if (canary[guard_index - 1] != CANARY_BYTE)	// overrun reached the record, which cannot be trusted
+	{
+		report_error("Error at line %d in file %s: Block was written past its end\n", line, filename);
+		return false;
+	}
+
+	guard_t guard;
+	memcpy(&guard, canary + guard_index, sizeof(guard_t));
+
+	size_t i = guard.request_size;
+	while (i < guard_index && canary[i] == CANARY_BYTE)
+	{
+		i++;
+	}
+	if (i == guard_index)
+	{
+		return true;
+	}
+
+	report_error("Error at line %d in file %s: Block of %zu bytes allocated at line %d in file %s was written past its end\n",
+			line, filename, guard.request_size, guard.line, guard.filename);
+	set_guard(ptr, usable_size, guard.request_size, guard.line, guard.filename);
+	return false;
+}
+#endif
+
+/*
+ * Finds a pointer's bit in the block map.
+ * @param *ptr Any pointer
+ * @param *word Set to the index of the word holding the bit
+ * @return Mask of the bit within its word, or 0 if ptr cannot be the data of a node, because it lies outside the heap reservation or is misaligned
+ */
+uint64_t get_block_bit(void *ptr, size_t *word)
+{
+	size_t offset = (char*) ptr - curr_heap->block;	// pointers below the heap wrap around to large offsets
+
+	if (curr_heap->block_map == NULL || offset >= curr_heap->heap_limit || offset % NODE_ALIGNMENT != 0)
+	{
+		return 0;
+	}
+
+	*word = offset / NODE_ALIGNMENT / 64;
+	return 1ULL << (offset / NODE_ALIGNMENT % 64);
+}
+
+/*
+ * Records that a block is handed out. Slots and huge blocks are tracked by their slab and by huge.c, and are ignored.
+ * @param *ptr Block that is being handed out
+ */
+void mark_handed_out(void *ptr)
+{
+	size_t word;
+	uint64_t bit = get_block_bit(ptr, &word);
+
+	if (bit != 0)
+	{
+		__atomic_fetch_or(&curr_heap->block_map[word], bit, __ATOMIC_RELAXED);	// neighbouring bits may be changed by threads freeing into their caches
+	}
+}
+
+/*
+ * Records that a block is no longer handed out, if it was.
+ * @param *ptr Any pointer
+ * @return True if ptr was a block in the heap that is handed out, false if it was freed already or never handed out
+ */
+bool unmark_handed_out(void *ptr)
+{
+	size_t word;
+	uint64_t bit = get_block_bit(ptr, &word);
+
+	return bit != 0 && (__atomic_fetch_and(&curr_heap->block_map[word], ~bit, __ATOMIC_RELAXED) & bit) != 0;	// of two threads freeing one block, only one sees the bit
+}
+
+/*
+ * Determines whether or not a pointer is a block in the heap that is handed out, without walking the heap or trusting the memory in front of ptr.
+ * @param *ptr Any pointer
+ * @return True if ptr is a block in the heap that is handed out, false otherwise
+ */
+bool is_handed_out(void *ptr)
+{
+	size_t word;
+	uint64_t bit = get_block_bit(ptr, &word);
+
+	return bit != 0 && (__atomic_load_n(&curr_heap->block_map[word], __ATOMIC_RELAXED) & bit) != 0;
+}
+
+/*
+ * Allocates space of requested size in "dynamic" memory.
+ * @param request_size Amount of memory requested by user
+ * @return Pointer to block of memory
+ */
+void *mymalloc(size_t request_size, int line, char* filename)
+{
+#if defined(MYMALLOC_TRACE) || defined(MYMALLOC_PROFILE) || defined(MYMALLOC_DEBUG)
+	size_t user_size = request_size;	// request_size is rounded below, the trace, the profile and the guard record what was asked for
+#endif
+
+	last_block_untouched = false;
+	setup_heap();
+	if (curr_heap->block == NULL)	// could not reserve the heap
+	{
+		stat_add(failed_allocs, 1);
+		trace_malloc(NULL, user_size, line, filename);
+		report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+		return NULL;
+	}
+	if (!validate_request(request_size, line, filename))
+	{
+		stat_add(failed_allocs, 1);
+		trace_malloc(NULL, user_size, line, filename);
+		return NULL;
+	}
+
+	request_size = round_request(request_size);
+	void *data_ptr;
+
+#ifdef MYMALLOC_THREAD_SAFE
+	if (curr_heap == &default_heap)	// only the default heap has thread caches and owners
+	{
+		if (!thread_cache_registered)
+		{
+			register_cache();
+		}
+		else if (thread_cache.owner != 0 && __atomic_load_n(&owned_frees[thread_cache.owner], __ATOMIC_RELAXED) != &remote_list_end)	// other threads freed our blocks
+		{
+			drain_owned_frees();
+		}
+	}
+
+	int cache_bin = curr_heap == &default_heap ? get_cache_bin(request_size) : -1;	// thread caches only hold blocks of the default heap
+	if (cache_bin > -1)	// small request, serve it from this thread's cache
+	{
+		if (thread_cache.bins[cache_bin] == NULL)
+		{
+			refill_cache(request_size, cache_bin);
+			last_block_untouched = false;	// cached blocks hold a link
+		}
+
+		cache_entry_t *entry = thread_cache.bins[cache_bin];
+		if (entry != NULL)	// otherwise no block of exactly this size could be cached, so one is taken from the shared heap below
+		{
+			thread_cache.bins[cache_bin] = entry->next;
+			thread_cache.counts[cache_bin]--;
+			if (slab_owns(entry))
+			{
+				slab_unmark_cached(entry);
+			}
+			else
+			{
+				mark_handed_out(entry);
+			}
+			set_owner(entry);
+			stat_alloc(request_size);	// refill_cache() files every block by its usable size
+			guard_block(entry, request_size, user_size, line, filename);
+			trace_malloc(entry, user_size, line, filename);
+			profile_malloc(entry, user_size, line, filename);
+			return entry;
+		}
+	}
+#endif
+
+	lock_heap();
+#ifdef MYMALLOC_THREAD_SAFE
+	data_ptr = allocate_or_reclaim(request_size);
+#else
+	data_ptr = allocate_block(request_size);
+#endif
+	if (data_ptr != NULL)
+	{
+		if (validate_ptr(data_ptr) && !slab_owns(data_ptr))	// the block map only covers nodes
+		{
+			mark_handed_out(data_ptr);
+		}
+		tag_owner(data_ptr);
+		stat_alloc(get_usable_size(data_ptr));
+		guard_block(data_ptr, get_usable_size(data_ptr), user_size, line, filename);
+	}
+	unlock_heap();
+
+	trace_malloc(data_ptr, user_size, line, filename);
+	if (data_ptr == NULL)
+	{
+		stat_add(failed_allocs, 1);
+		report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+	}
+	else
+	{
+		profile_malloc(data_ptr, user_size, line, filename);
+	}
+
+	return data_ptr;
+} //end of mymalloc(size_t size)
+
+/*
+ * Determines whether or not a pointer lies within the usable part of the memory array, or within the slab area
+ * @param *ptr Prospective pointer
+ * @return True if pointer is within the array or the slab area, false otherwise
+ */
+bool validate_ptr(void *ptr)
+{
+	return (curr_heap->block != NULL && (void*) curr_heap->block <= ptr && ptr < (void*) &curr_heap->block[curr_heap->heap_size])
+			|| (curr_heap == &default_heap && slab_owns(ptr));
+}
+
+/*
+ * Determines whether or not an index holds a real metadata node, by checking that the header is consistent with its surroundings.
+ * The node must be aligned and fit in the memory array, and the nodes on either side must agree with its flags.
+ * In buddy system mode the node is a buddy block, and must be a power of two in size and aligned to its size instead.
+ * @param curr_mem_index Prospective index of a metadata node
+ * @return True if the header looks like a node created by mymalloc(), false otherwise
+ */
+bool validate_node(int curr_mem_index)
+{
+#ifdef MYMALLOC_BUDDY
+	return buddy_validate(curr_mem_index);
+#endif
+
+	if (curr_mem_index < 0 || curr_mem_index % NODE_ALIGNMENT != 0)	// nodes only start at aligned indices within the array
+	{
+		return false;
+	}
+
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	size_t end_index = curr_mem_index + sizeof(node_t) + curr_node->size;
+
+	if (curr_node->size < MIN_PAYLOAD_SIZE || curr_node->size % NODE_ALIGNMENT != 0 || end_index > curr_heap->heap_size)	// no node has this size
+	{
+		return false;
+	}
+
+	if (!curr_node->prev_active)	// previous node must be inactive and end right where this one starts
+	{
+		int prev_mem_index = get_prev_index(curr_mem_index);
+		if (prev_mem_index < 0 || ((node_t*) &curr_heap->block[prev_mem_index])->active)
+		{
+			return false;
+		}
+	}
+
+	if (end_index >= curr_heap->heap_size - sizeof(node_t))	// last node, check against the tail flag instead
+	{
+		return curr_heap->tail_active == curr_node->active;
+	}
+
+	node_t *next_node = (node_t*) &curr_heap->block[end_index];
+	return next_node->prev_active == curr_node->active;
+}
+
+/*
+ * Merges two nodes.
+ * The first node absorbs the second node, creating one large node.
+ * @param first_index Index of the first node
+ * @param second_index Index of the second node
+ */
+void merge_two_nodes(int first_index, int second_index)
+{
+	node_t *first_node = (node_t*) &curr_heap->block[first_index];
+	node_t *second_node = (node_t*) &curr_heap->block[second_index];
+
+	unsigned int combined_size = first_node->size + sizeof(node_t) + second_node->size;
+	first_node->size = combined_size;	// overwrites second node
+	stat_add(merges, 1);
+
+	int second_end = second_index + sizeof(node_t) + sizeof(free_links_t);
+	if (second_end > curr_heap->untouched_index)	// second node's header and links are now leftovers inside the first node's data
+	{
+		curr_heap->untouched_index = second_end;
+	}
+
+	if (curr_heap->next_fit_index == second_index)	// second node no longer exists
+	{
+		curr_heap->next_fit_index = first_index;
+	}
+}
+
+/*
+ * Attempts to combine the current node with the node before and after it.
+ * Nodes can only be combined if they are both inactive.
+ * @param prev_mem_index Index of the previous node
+ * @param curr_mem_index Index of the current node
+ * @param next_mem_index Index of the next node
+ */
+void combine_nodes(int prev_mem_index, int curr_mem_index, int next_mem_index)
+{
+	node_t *adjacent_node;
+	if (next_mem_index > -1)	// next node exists
+	{
+		adjacent_node = (node_t*) &curr_heap->block[next_mem_index];
+		if (!adjacent_node->active)	// next node is also inactive, join them!
+		{
+			remove_free_node(next_mem_index);
+			merge_two_nodes(curr_mem_index, next_mem_index);
+		}
+	}
+	
+	if (prev_mem_index > -1)	// previous node exists
+	{
+		adjacent_node = (node_t*) &curr_heap->block[prev_mem_index];
+		if (!adjacent_node->active)	// previous node is inactive, join them!!
+		{
+			remove_free_node(prev_mem_index);
+			merge_two_nodes(prev_mem_index, curr_mem_index);
+			curr_mem_index = prev_mem_index;
+		}
+	}
+
+	insert_free_node(curr_mem_index);	// combined node goes into the bin for its new size
+}
+
+/*
+ * Frees a block of dynamically allocated memory for future use.
+ * Freed memory cannot be accessed.
+ * @param *ptr Pointer to a previous allocation performed by mymalloc()
+ */
+void myfree(void *ptr, int LINE, char *FILE)
+{
+
+	if(ptr == NULL)
+	{
+		stat_add(failed_frees, 1);
+		report_error("Error at line %d in file %s: Cannot free a NULL pointer\n", LINE, FILE);
+		return;
+	}
+
+	if (!validate_ptr(ptr))	// check that address is within our memory array
+	{
+		lock_heap();
+		bool freed = curr_heap == &default_heap && free_huge_block(ptr, LINE, FILE);
+		unlock_heap();
+
+		if (!freed)
+		{
+			stat_add(failed_frees, 1);
+			report_error("Error at line %d in file %s: Argument is not an address within the heap\n", LINE, FILE);
+		}
+		return;
+	}
+
+#ifdef MYMALLOC_DEBUG
+	lock_heap();
+	check_guard(ptr, LINE, FILE);
+	unlock_heap();
+#endif
+
+#ifdef MYMALLOC_THREAD_SAFE
+	if (curr_heap == &default_heap)	// blocks of the default heap go back to the thread that allocated them
+	{
+		if (!thread_cache_registered)
+		{
+			register_cache();
+		}
+
+		int owner = get_owner(ptr);
+		if (owner != 0 && owner != thread_cache.owner && free_to_owner(ptr, owner, LINE, FILE))	// another thread's block, without the lock
+		{
+			return;
+		}
+		if (free_to_cache(ptr, LINE, FILE))	// small blocks never need the lock
+		{
+			return;
+		}
+	}
+	if (!slab_owns(ptr) && unmark_handed_out(ptr))	// larger nodes never wait for the lock
+	{
+		stat_free(((node_t*) ptr - 1)->size);
+		profile_free(ptr);
+		trace_free(ptr, LINE, FILE);
+
+		if (pthread_mutex_trylock(&curr_heap->lock) == 0)	// lock is free, file the node now
+		{
+			drain_remote_frees();
+			free_node((int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t));
+			unlock_heap();
+		}
+		else	// another thread holds the lock, and the next thread to take it files the node
+		{
+			push_remote_free(ptr);
+		}
+		return;
+	}
+#endif
+
+	if (slab_owns(ptr))	// tiny object, its slab knows whether it is handed out
+	{
+		lock_heap();
+		stat_free(slab_usable_size(ptr));	// 0 unless the slot is handed out
+		slab_result result = slab_free(ptr);
+		if (result == SLAB_FREED)	// before the slot can be handed out again
+		{
+			profile_free(ptr);
+		}
+		unlock_heap();
+
+		if (result == SLAB_ALREADY_FREED)
+		{
+			stat_add(failed_frees, 1);
+			report_error("Error at line %d in file %s: Pointer was already freed!\n", LINE, FILE);
+		}
+		else if (result == SLAB_NOT_A_SLOT)
+		{
+			stat_add(failed_frees, 1);
+			report_error("Error at line %d in file %s: Argument is not a pointer returned by malloc()\n", LINE, FILE);
+		}
+		else
+		{
+			trace_free(ptr, LINE, FILE);
+		}
+		return;
+	}
+
+	int curr_mem_index = (int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t);	// we will attempt to free this node
+
+	lock_heap();
+
+	if (!unmark_handed_out(ptr))	// not handed out, the header only tells why
+	{
+		stat_add(failed_frees, 1);
+		bool freed = validate_node(curr_mem_index);	// header is one we wrote, so the node was freed, otherwise data was not a pointer
+		unlock_heap();
+		report_error(freed ? "Error at line %d in file %s: Pointer was already freed!\n"
+				: "Error at line %d in file %s: Argument is not a pointer returned by malloc()\n", LINE, FILE);
+		return;
+	}
+
+	stat_free(((node_t*) ptr - 1)->size);
+	profile_free(ptr);
+	free_node(curr_mem_index);
+	unlock_heap();
+	trace_free(ptr, LINE, FILE);
+	return;
+} //end of myfree(void * freePtr)
+
+/*
+ * Frees a huge block, unmapping it so its memory goes straight back to the operating system.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer that lies outside the heap and the slab area
+ * @return True if ptr was a huge block that is handed out and is now freed, false if the caller must report it
+ */
+bool free_huge_block(void *ptr, int LINE, char *FILE)
+{
+	size_t usable_size = huge_usable_size(ptr);
+	if (usable_size == 0)
+	{
+		return false;
+	}
+
+	check_block(ptr, LINE, FILE);
+	stat_free(usable_size);
+	profile_free(ptr);
+	huge_free(ptr);
+	trace_free(ptr, LINE, FILE);
+	return true;
+}
+
+/*
+ * Looks up how many bytes of a block the user can use, which may be more than they asked for.
+ * @param *ptr Pointer returned by mymalloc()
+ * @return Usable size of the block, or 0 if ptr is not a block that is handed out
+ */
+size_t mymalloc_usable_size(void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return 0;
+	}
+
+	lock_heap();
+	size_t usable_size = get_usable_size(ptr);
+#ifdef MYMALLOC_DEBUG
+	if (usable_size > 0)	// the guard is not the user's to write
+	{
+		guard_t guard;
+		memcpy(&guard, (char*) ptr + usable_size - sizeof(guard_t), sizeof(guard_t));
+		usable_size = guard.request_size;
+	}
+#endif
+	unlock_heap();
+
+	return usable_size;
+}
+
+/*
+ * Looks up the usable size of a block.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer other than NULL
+ * @return Usable size of the block, or 0 if ptr is not a block that is handed out
+ */
+size_t get_usable_size(void *ptr)
+{
+	if (slab_owns(ptr))
+	{
+		return slab_usable_size(ptr);
+	}
+	if (!validate_ptr(ptr))
+	{
+		return huge_usable_size(ptr);
+	}
+
+	if (is_handed_out(ptr))
+	{
+		return ((node_t*) ptr - 1)->size;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocates zeroed space for an array.
+ * Nodes that start past untouched_index are still zero from mmap(), so only their old free links and boundary tag are cleared.
+ * @param num_items Number of items in the array
+ * @param item_size Size of one item in bytes
+ * @return Pointer to the zeroed block, or NULL if the request is invalid or there is no memory left
+ */
+void *mycalloc(size_t num_items, size_t item_size, int line, char* filename)
+{
+	if (item_size > 0 && num_items > (size_t) -1 / item_size)	// total size does not fit in a size_t
+	{
+		stat_add(failed_allocs, 1);
+		report_error("Error at line %d in file %s: Request is too large! %zu items of %zu bytes\n", line, filename, num_items, item_size);
+		return NULL;
+	}
+
+	size_t request_size = num_items * item_size;
+	char *data_ptr = mymalloc(request_size, line, filename);
+
+	if (data_ptr == NULL)
+	{
+		return NULL;
+	}
+
+	if (round_request(request_size) >= MYMALLOC_HUGE_THRESHOLD)	// mapping is fresh from mmap(), so already zero
+	{
+		return data_ptr;
+	}
+
+	if (!last_block_untouched)
+	{
+		memset(data_ptr, 0, request_size);
+		return data_ptr;
+	}
+
+	unsigned int node_size = ((node_t*) data_ptr - 1)->size;
+	memset(data_ptr, 0, sizeof(free_links_t));	// node only ever held its free links and boundary tag
+	memset(data_ptr + node_size - sizeof(footer_t), 0, sizeof(footer_t));
+	return data_ptr;
+}
+
+/*
+ * Resizes a handed out block without copying it, if it can.
+ * A node shrinks by giving its end back to the heap, and grows by absorbing the inactive node after it, growing the heap first if that node is the last one.
+ * Slots and buddy blocks only keep their place if they are already large enough.
+ * Huge blocks are remapped, which may move them, but moves their pages instead of copying their data. A block never becomes huge, or stops being huge, in place.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer to a block that is handed out
+ * @param request_size New size in bytes, at least 1
+ * @return Pointer to the block, which only differs from ptr for huge blocks, or NULL if it must be copied to a new block
+ */
+void *resize_block(void *ptr, size_t request_size)
+{
+	size_t new_size = round_request(request_size);
+
+	if (slab_owns(ptr))	// slots all have one size
+	{
+		return new_size <= slab_usable_size(ptr) ? ptr : NULL;
+	}
+
+	if (!validate_ptr(ptr))	// huge block
+	{
+#ifdef MYMALLOC_STATS
+		size_t old_size = huge_usable_size(ptr);	// only the counters need it
+#endif
+		void *new_ptr = new_size >= MYMALLOC_HUGE_THRESHOLD ? huge_resize(ptr, new_size) : NULL;
+		if (new_ptr != NULL)
+		{
+			stat_free(old_size);
+			stat_alloc(huge_usable_size(new_ptr));
+		}
+		return new_ptr;
+	}
+
+	if (new_size >= MYMALLOC_HUGE_THRESHOLD)	// moves to a mapping of its own
+	{
+		return NULL;
+	}
+
+#ifdef MYMALLOC_BUDDY
+	if (new_size > ((node_t*) ptr - 1)->size)	// buddy blocks only split and merge as whole halves
+	{
+		return NULL;
+	}
+	remove_slack((int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t));
+	add_slack((int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t), new_size);
+	return ptr;
+#endif
+
+	int curr_mem_index = (int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t);
+	node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+	unsigned int old_size = curr_node->size;
+
+	if (new_size < MIN_PAYLOAD_SIZE)	// node must still be able to hold its free links once it is freed
+	{
+		new_size = MIN_PAYLOAD_SIZE;
+	}
+
+	if (new_size > old_size)
+	{
+		int next_mem_index = get_next_index(curr_mem_index);
+		unsigned int available = old_size;
+
+		if (next_mem_index > -1 && !((node_t*) &curr_heap->block[next_mem_index])->active)
+		{
+			available += sizeof(node_t) + ((node_t*) &curr_heap->block[next_mem_index])->size;
+		}
+
+		bool at_tail = next_mem_index < 0 || (available > old_size && get_next_index(next_mem_index) < 0);
+		if (available < new_size && at_tail && grow_heap(new_size - available))	// heap grows right after this node
+		{
+			next_mem_index = get_next_index(curr_mem_index);
+			available = old_size + sizeof(node_t) + ((node_t*) &curr_heap->block[next_mem_index])->size;
+		}
+
+		if (available < new_size)
+		{
+			return NULL;
+		}
+
+		remove_slack(curr_mem_index);	// before the node grows past the end remove_slack() searches from
+		remove_free_node(next_mem_index);
+		merge_two_nodes(curr_mem_index, next_mem_index);
+		set_active(curr_mem_index, 1);	// node after the absorbed one now follows an active node
+	}
+
+	remove_slack(curr_mem_index);
+	trim_node(curr_mem_index, new_size);
+	add_slack(curr_mem_index, new_size);
+	claim_untouched(curr_mem_index);
+
+	stat_free(old_size);
+	stat_alloc(curr_node->size);
+	return ptr;
+}
+
+/*
+ * Resizes a block, keeping its contents up to the smaller of the old and new sizes.
+ * The block is resized in place when resize_block() can, and moved to a new block otherwise.
+ * @param *ptr Pointer returned by mymalloc(), or NULL to allocate a new block
+ * @param request_size New size in bytes. A size of 0 frees the block.
+ * @return Pointer to the resized block, or NULL if it was freed or could not be resized. A block that could not be resized is left as it was.
+ */
+void *myrealloc(void *ptr, size_t request_size, int line, char* filename)
+{
+	if (ptr == NULL)
+	{
+		return mymalloc(request_size, line, filename);
+	}
+	if (request_size == 0)
+	{
+		myfree(ptr, line, filename);
+		return NULL;
+	}
+	if (!validate_request(request_size, line, filename))
+	{
+		stat_add(failed_allocs, 1);
+		return NULL;
+	}
+
+	lock_heap();
+	size_t usable_size = get_usable_size(ptr);
+	if (usable_size == 0)
+	{
+		stat_add(failed_frees, 1);
+		unlock_heap();
+		report_error("Error at line %d in file %s: Argument is not a pointer returned by malloc() that is still handed out\n", line, filename);
+		return NULL;
+	}
+
+	check_block(ptr, line, filename);
+	void *resized_ptr = resize_block(ptr, request_size);
+	if (resized_ptr != NULL)
+	{
+		guard_block(resized_ptr, get_usable_size(resized_ptr), request_size, line, filename);
+		profile_free(ptr);
+		unlock_heap();
+		trace_free(ptr, line, filename);	// traces have no resize, record it as a free and a malloc of the same block
+		trace_malloc(resized_ptr, request_size, line, filename);
+		profile_malloc(resized_ptr, request_size, line, filename);
+		return resized_ptr;
+	}
+	unlock_heap();
+
+	void *new_ptr = mymalloc(request_size, line, filename);
+	if (new_ptr == NULL)
+	{
+		return NULL;
+	}
+
+	memcpy(new_ptr, ptr, usable_size < request_size ? usable_size : request_size);
+	myfree(ptr, line, filename);
+	return new_ptr;
+}
+
+/*
+ * Allocates space whose address is a multiple of an alignment.
+ * A node with room for the alignment is taken from the heap, and the space in front of the aligned address and after the request is given back.
+ * Huge blocks start on a page, so they are aligned to MAX_ALIGNMENT already, even in the buddy system.
+ * Not supported by the buddy system, whose blocks always start 4 bytes past a power of two.
+ * @param alignment Required alignment, a power of two of at most MAX_ALIGNMENT
+ * @param request_size Amount of memory requested by user
+ * @return Pointer to the aligned block, or NULL if the request is invalid or there is no memory left
+ */
+void *myaligned_alloc(size_t alignment, size_t request_size, int line, char* filename)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > MAX_ALIGNMENT)
+	{
+		stat_add(failed_allocs, 1);
+		report_error("Error at line %d in file %s: Alignment must be a power of two up to %d; your alignment: %zu\n", line, filename, MAX_ALIGNMENT, alignment);
+		return NULL;
+	}
+	if (alignment <= NODE_ALIGNMENT || request_size >= MYMALLOC_HUGE_THRESHOLD)	// every block is already aligned this well, and huge blocks start on a page
+	{
+		return mymalloc(request_size, line, filename);
+	}
+
+#ifdef MYMALLOC_BUDDY
+	stat_add(failed_allocs, 1);
+	report_error("Error at line %d in file %s: Aligned allocation is not supported by the buddy system\n", line, filename);
+	return NULL;
+#endif
+
+	setup_heap();
+	if (curr_heap->block == NULL || !validate_request(request_size, line, filename))
+	{
+		stat_add(failed_allocs, 1);
+		trace_malloc(NULL, request_size, line, filename);
+		if (curr_heap->block == NULL)
+		{
+			report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+		}
+		return NULL;
+	}
+
+	unsigned int size = round_request(request_size);
+	if (size < MIN_PAYLOAD_SIZE)
+	{
+		size = MIN_PAYLOAD_SIZE;
+	}
+
+	lock_heap();
+	char *data_ptr = allocate_from_heap(size + alignment + sizeof(node_t) + MIN_PAYLOAD_SIZE);	// room for an inactive node in front of any aligned address
+	if (data_ptr != NULL)
+	{
+		int curr_mem_index = data_ptr - curr_heap->block - sizeof(node_t);
+		unsigned int misalignment = (uintptr_t) data_ptr & (alignment - 1);
+		remove_slack(curr_mem_index);	// only the aligned node is kept, its slack is worked out once it is trimmed
+
+		if (misalignment != 0)	// split off the space in front of the aligned address and give it back
+		{
+			unsigned int lead = alignment - misalignment;
+			while (lead < sizeof(node_t) + MIN_PAYLOAD_SIZE)
+			{
+				lead += alignment;
+			}
+
+			split_node(curr_mem_index, lead - sizeof(node_t));
+			int aligned_index = curr_mem_index + lead;
+			remove_free_node(aligned_index);
+			set_active(aligned_index, 1);
+			release_to_heap(curr_mem_index);
+
+			curr_mem_index = aligned_index;
+			data_ptr = get_data_ptr(aligned_index);
+		}
+
+		trim_node(curr_mem_index, size);
+		add_slack(curr_mem_index, size);
+		mark_handed_out(data_ptr);
+		tag_owner(data_ptr);
+		stat_alloc(((node_t*) &curr_heap->block[curr_mem_index])->size);
+		guard_block(data_ptr, ((node_t*) &curr_heap->block[curr_mem_index])->size, request_size, line, filename);
+	}
+	unlock_heap();
+
+	trace_malloc(data_ptr, request_size, line, filename);
+	if (data_ptr == NULL)
+	{
+		stat_add(failed_allocs, 1);
+		report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+	}
+	else
+	{
+		profile_malloc(data_ptr, request_size, line, filename);
+	}
+
+	return data_ptr;
+}
+
+/*
+ * Carves the blocks of a batch out of a single node, laying out every header in one pass instead of searching the heap once per block.
+ * The last block keeps any space the node had beyond the batch.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param num_blocks Number of blocks, at least 1
+ * @param request_size Size of each block, already rounded by round_request() and too large for a slab
+ * @param **out Set to the blocks
+ * @return True if one node held the whole batch, false if nothing was allocated
+ */
+bool carve_batch(size_t num_blocks, unsigned int request_size, void **out)
+{
+#ifdef MYMALLOC_BUDDY
+	return false;	// buddy blocks cannot be cut into arbitrary sizes
+#endif
+
+	size_t stride = request_size + sizeof(node_t);
+	if (num_blocks > HEAP_SIZE_LIMIT / stride)	// batch is larger than any node
+	{
+		return false;
+	}
+
+	char *data_ptr = allocate_from_heap(num_blocks * stride - sizeof(node_t));
+	if (data_ptr == NULL)
+	{
+		return false;
+	}
+
+	int curr_mem_index = data_ptr - curr_heap->block - sizeof(node_t);
+	unsigned int last_size = ((node_t*) &curr_heap->block[curr_mem_index])->size - (num_blocks - 1) * stride;
+	size_t i;
+
+	for (i = 0; i < num_blocks; i++)	// the node after the batch already knows an active node is in front of it
+	{
+		node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+		curr_node->size = i == num_blocks - 1 ? last_size : request_size;
+		curr_node->active = 1;
+		if (i > 0)
+		{
+			curr_node->prev_active = 1;
+		}
+
+		out[i] = get_data_ptr(curr_mem_index);
+		mark_handed_out(out[i]);
+		tag_owner(out[i]);
+		stat_alloc(curr_node->size);
+		curr_mem_index += stride;
+	}
+
+	stat_add(splits, num_blocks - 1);
+	return true;
+}
+
+/*
+ * Allocates a batch of blocks of the same size, validating the request and taking the lock once.
+ * Blocks too large for a slab are carved out of one node when one is large enough, and are taken one by one otherwise. Huge blocks are always taken one by one.
+ * @param num_blocks Number of blocks to allocate
+ * @param request_size Size of each block in bytes
+ * @param **out Room for num_blocks pointers, set to the blocks
+ * @return True if every block was allocated. Otherwise none are, and out is filled with NULL.
+ */
+bool mymalloc_batch(size_t num_blocks, size_t request_size, void **out, int line, char* filename)
+{
+	size_t i;
+
+	if (num_blocks == 0)
+	{
+		return true;
+	}
+
+	setup_heap();
+	if (curr_heap->block == NULL || !validate_request(request_size, line, filename))
+	{
+		for (i = 0; i < num_blocks; i++)
+		{
+			out[i] = NULL;
+		}
+		stat_add(failed_allocs, 1);
+		trace_malloc(NULL, request_size, line, filename);
+		if (curr_heap->block == NULL)
+		{
+			report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+		}
+		return false;
+	}
+
+	size_t size = round_request(request_size);
+
+	lock_heap();
+	bool allocated = size > SLAB_MAX_SIZE && size < MYMALLOC_HUGE_THRESHOLD && carve_batch(num_blocks, size, out);
+	if (!allocated)	// tiny blocks come from slabs, huge blocks get a mapping each, and a fragmented heap may need several nodes
+	{
+		for (i = 0; i < num_blocks; i++)
+		{
+#ifdef MYMALLOC_THREAD_SAFE
+			out[i] = allocate_or_reclaim(size);
+#else
+			out[i] = allocate_block(size);
+#endif
+			if (out[i] == NULL)
+			{
+				break;
+			}
+			mark_handed_out(out[i]);
+			tag_owner(out[i]);
+			stat_alloc(get_usable_size(out[i]));
+		}
+
+		allocated = i == num_blocks;
+		while (!allocated && i-- > 0)	// all or nothing, give back what was taken
+		{
+			stat_free(get_usable_size(out[i]));
+			unmark_handed_out(out[i]);
+			release_block(out[i]);
+		}
+	}
+#ifdef MYMALLOC_DEBUG
+	for (i = 0; allocated && i < num_blocks; i++)
+	{
+		set_guard(out[i], get_usable_size(out[i]), request_size, line, filename);
+	}
+#endif
+	unlock_heap();
+
+	if (!allocated)
+	{
+		for (i = 0; i < num_blocks; i++)
+		{
+			out[i] = NULL;
+		}
+		stat_add(failed_allocs, 1);
+		trace_malloc(NULL, request_size, line, filename);
+		report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+		return false;
+	}
+
+	for (i = 0; i < num_blocks; i++)
+	{
+		trace_malloc(out[i], request_size, line, filename);
+		profile_malloc(out[i], request_size, line, filename);
+	}
+
+	return true;
+}
+
+/*
+ * Orders pointers by address for qsort().
+ */
+static int compare_pointers(const void *a, const void *b)
+{
+	uintptr_t first = (uintptr_t) *(void* const*) a;
+	uintptr_t second = (uintptr_t) *(void* const*) b;
+	return (first > second) - (first < second);
+}
+
+/*
+ * Frees a batch of blocks, taking the lock once.
+ * The pointers are sorted by address, so each run of neighbouring nodes is merged into one node as it is found,
+ * and is filed in a bin once instead of once per block.
+ * Every pointer is checked like myfree() checks it, and invalid ones are reported and skipped.
+ * @param **ptrs Pointers to free. The array is sorted in place.
+ * @param num_ptrs Number of pointers
+ */
+void myfree_batch(void **ptrs, size_t num_ptrs, int LINE, char *FILE)
+{
+	int run_index = -1;	// first node of the run of neighbouring nodes being freed, still marked active until the run ends
+	size_t i;
+
+	i = 1;
+	while (i < num_ptrs && compare_pointers(&ptrs[i - 1], &ptrs[i]) <= 0)	// find the first pair out of order
+	{
+		i++;
+	}
+	if (i < num_ptrs)	// batches are usually freed in the order they were allocated, which is already sorted
+	{
+		qsort(ptrs, num_ptrs, sizeof(void*), compare_pointers);
+	}
+
+	lock_heap();
+	for (i = 0; i < num_ptrs; i++)
+	{
+		void *ptr = ptrs[i];
+
+		if (ptr == NULL)
+		{
+			stat_add(failed_frees, 1);
+			report_error("Error at line %d in file %s: Cannot free a NULL pointer\n", LINE, FILE);
+			continue;
+		}
+		if (!validate_ptr(ptr))
+		{
+			if (!free_huge_block(ptr, LINE, FILE))
+			{
+				stat_add(failed_frees, 1);
+				report_error("Error at line %d in file %s: Argument is not an address within the heap\n", LINE, FILE);
+			}
+			continue;
+		}
+		if (i > 0 && ptr == ptrs[i - 1])	// sorting put the copies next to each other
+		{
+			stat_add(failed_frees, 1);
+			report_error("Error at line %d in file %s: Pointer was already freed!\n", LINE, FILE);
+			continue;
+		}
+		check_block(ptr, LINE, FILE);
+
+		if (slab_owns(ptr))
+		{
+			stat_free(slab_usable_size(ptr));	// 0 unless the slot is handed out
+			slab_result result = slab_free(ptr);
+			if (result == SLAB_FREED)
+			{
+				profile_free(ptr);
+				trace_free(ptr, LINE, FILE);
+			}
+			else
+			{
+				stat_add(failed_frees, 1);
+				report_error(result == SLAB_ALREADY_FREED ? "Error at line %d in file %s: Pointer was already freed!\n"
+						: "Error at line %d in file %s: Argument is not a pointer returned by malloc()\n", LINE, FILE);
+			}
+			continue;
+		}
+
+		int curr_mem_index = (int) ((char*) ptr - curr_heap->block) - (int) sizeof(node_t);
+		if (!unmark_handed_out(ptr))
+		{
+			stat_add(failed_frees, 1);
+			report_error(validate_node(curr_mem_index) ? "Error at line %d in file %s: Pointer was already freed!\n"
+					: "Error at line %d in file %s: Argument is not a pointer returned by malloc()\n", LINE, FILE);
+			continue;
+		}
+
+		stat_free(((node_t*) ptr - 1)->size);
+		profile_free(ptr);
+		trace_free(ptr, LINE, FILE);
+		remove_slack(curr_mem_index);	// before a run grows the node past the end remove_slack() searches from
+
+#ifdef MYMALLOC_BUDDY
+		free_node(curr_mem_index);	// buddy blocks only merge with their buddy, never into a run
+		continue;
+#endif
+
+		if (defer_coalescing)	// the node goes on its quick list, as myfree() would put it
+		{
+			free_node(curr_mem_index);
+			continue;
+		}
+
+		if (run_index > -1 && get_next_index(run_index) == curr_mem_index)	// node continues the run
+		{
+			merge_two_nodes(run_index, curr_mem_index);
+			continue;
+		}
+
+		if (run_index > -1)
+		{
+			free_node(run_index);
+		}
+		run_index = curr_mem_index;
+	}
+
+	if (run_index > -1)
+	{
+		free_node(run_index);
+	}
+	unlock_heap();
+}
+
+/*
+ * Creates a heap of its own, for a subsystem whose blocks should sit together and be freed at once, see heap_t.
+ * Not supported by the buddy system, which keeps a single set of free lists.
+ * @param max_size Bytes the heap may grow to. It starts with MYMALLOC_REGION_SIZE of them usable, or all of them if that is fewer.
+ * @return Handle of the heap, or NULL if the size is invalid or no address space is left
+ */
+heap_t *myheap_create(size_t max_size, int line, char *filename)
+{
+#ifdef MYMALLOC_BUDDY
+	report_error("Error at line %d in file %s: Heaps of their own are not supported by the buddy system\n", line, filename);
+	return NULL;
+#endif
+
+	if (max_size < 1 || max_size > HEAP_SIZE_LIMIT)
+	{
+		report_error("Error at line %d in file %s: Heap size must be from 1 to %lu bytes; your size: %zu\n", line, filename, HEAP_SIZE_LIMIT, max_size);
+		return NULL;
+	}
+
+	setup_heap();	// the default heap comes first, which also fixes the placement policy for every heap
+
+	size_t header_size = round_to_pages(sizeof(heap_t));
+	size_t reserve_size = round_to_pages(max_size);
+	size_t usable_size = reserve_size < round_to_pages(MYMALLOC_REGION_SIZE) ? reserve_size : round_to_pages(MYMALLOC_REGION_SIZE);
+	size_t map_size = get_map_size(reserve_size);
+
+	// the handle, the heap and its maps share one reservation, so destroying the heap takes a single munmap()
+	char *reservation = mmap(NULL, header_size + reserve_size + 2 * map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reservation == MAP_FAILED)
+	{
+		report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+		return NULL;
+	}
+	if (mprotect(reservation, header_size + usable_size, PROT_READ | PROT_WRITE) != 0
+			|| mprotect(reservation + header_size + reserve_size, 2 * map_size, PROT_READ | PROT_WRITE) != 0)
+	{
+		munmap(reservation, header_size + reserve_size + 2 * map_size);
+		report_error("Error at line %d in file %s: Out of memory!\n", line, filename);
+		return NULL;
+	}
+
+	heap_t *heap = (heap_t*) reservation;
+	heap->reserve_size = header_size + reserve_size + 2 * map_size;
+
+	heap_t *prev_heap = curr_heap;
+	curr_heap = heap;
+	init_heap(reservation + header_size, usable_size, reserve_size, (uint64_t*) (reservation + header_size + reserve_size));
+	curr_heap = prev_heap;
+
+#ifdef MYMALLOC_THREAD_SAFE
+	pthread_mutex_init(&heap->lock, NULL);
+	pthread_mutex_lock(&default_heap.lock);
+#endif
+	heap->next = created_heaps;
+	created_heaps = heap;
+#ifdef MYMALLOC_THREAD_SAFE
+	pthread_mutex_unlock(&default_heap.lock);
+#endif
+
+	return heap;
+}
+
+/*
+ * Allocates space from a heap made by myheap_create(), like mymalloc() does from the default heap.
+ * @param *heap Heap to allocate from
+ * @param request_size Amount of memory requested by user
+ * @return Pointer to the block, or NULL if the request is invalid or the heap is out of memory
+ */
+void *myheap_alloc(heap_t *heap, size_t request_size, int line, char *filename)
+{
+	heap_t *prev_heap = curr_heap;
+
+	curr_heap = heap;
+	void *ptr = mymalloc(request_size, line, filename);
+	curr_heap = prev_heap;
+
+	return ptr;
+}
+
+/*
+ * Frees a block of a heap made by myheap_create(), like myfree() does for the default heap.
+ * Pointers that do not lie within the heap are reported, even if another heap handed them out.
+ * @param *heap Heap the block came from
+ * @param *ptr Pointer returned by myheap_alloc() for the same heap
+ */
+void myheap_free(heap_t *heap, void *ptr, int LINE, char *FILE)
+{
+	heap_t *prev_heap = curr_heap;
+
+	curr_heap = heap;
+	myfree(ptr, LINE, FILE);
+	curr_heap = prev_heap;
+}
+
+/*
+ * Destroys a heap made by myheap_create(), freeing every block still handed out from it at once by unmapping the whole reservation.
+ * No other thread may be using the heap, and its blocks must not be used afterwards.
+ * @param *heap Heap to destroy
+ */
+void myheap_destroy(heap_t *heap, int line, char *filename)
+{
+	if (heap == NULL)
+	{
+		report_error("Error at line %d in file %s: Cannot destroy a NULL heap\n", line, filename);
+		return;
+	}
+
+#ifdef MYMALLOC_THREAD_SAFE
+	pthread_mutex_lock(&default_heap.lock);
+#endif
+	heap_t **link = &created_heaps;
+	while (*link != NULL && *link != heap)
+	{
+		link = &(*link)->next;
+	}
+	bool made_here = *link != NULL;
+	if (made_here)
+	{
+		*link = heap->next;	// unlinked before the blocks are walked, so no other call can destroy it twice
+	}
+#ifdef MYMALLOC_THREAD_SAFE
+	pthread_mutex_unlock(&default_heap.lock);
+#endif
+
+	if (!made_here)
+	{
+		report_error("Error at line %d in file %s: Cannot destroy a heap that is not a heap made by heap_create()\n", line, filename);
+		return;
+	}
+
+#if defined(MYMALLOC_STATS) || defined(MYMALLOC_PROFILE)
+	heap_t *prev_heap = curr_heap;
+	curr_heap = heap;
+
+	int curr_mem_index = 0;
+	while (curr_mem_index > -1)	// only the counters and the profile need to hear about each block
+	{
+		void *data_ptr = get_data_ptr(curr_mem_index);
+		if (is_handed_out(data_ptr))
+		{
+			stat_free(((node_t*) data_ptr - 1)->size);
+			profile_free(data_ptr);
+		}
+		curr_mem_index = get_next_index(curr_mem_index);
+	}
+
+	curr_heap = prev_heap;
+#endif
+
+#ifdef MYMALLOC_THREAD_SAFE
+	pthread_mutex_destroy(&heap->lock);
+#endif
+
+	munmap(heap, heap->reserve_size);
+}
+
+#ifdef MYMALLOC_THREAD_SAFE
+/*
+ * Registers a key whose destructor flushes a thread's cache when the thread exits.
+ */
+static void create_cache_key()
+{
+	pthread_key_create(&cache_key, flush_cache);
+}
+
+/*
+ * Determines which thread cache bin holds nodes of a given size.
+ * @param size Node size, already rounded by mymalloc()
+ * @return Index of the bin, or -1 if nodes of this size are not cached
+ */
+int get_cache_bin(size_t size)
+{
+	if (size > TCACHE_MAX_SIZE)
+	{
+		return -1;
+	}
+
+	return size / NODE_ALIGNMENT - 1;
+}
+
+/*
+ * Takes a node from the shared heap. If the heap is out of memory, the calling thread's cached blocks are given back first and the request is retried.
+ * The caller must hold the heap lock.
+ * @param request_size Amount of space requested, already rounded by mymalloc()
+ * @return Pointer to the node's data, or NULL if the heap is out of memory
+ */
+void *allocate_or_reclaim(size_t request_size)
+{
+	void *data_ptr = allocate_block(request_size);
+
+	if (data_ptr == NULL && curr_heap == &default_heap)	// blocks sitting in this thread's cache may be all that is missing
+	{
+		int i;
+		for (i = 0; i < TCACHE_NUM_BINS; i++)
+		{
+			release_cache_bin(&thread_cache, i, TCACHE_MAX_COUNT);
+		}
+		data_ptr = allocate_block(request_size);
+	}
+
+	return data_ptr;
+}
+
+/*
+ * Fills an empty bin of the calling thread's cache with up to TCACHE_BATCH nodes from the shared heap, taking the lock once.
+ * A node that comes back larger than asked, because the rest of its free node was too small to split off, is filed in the bin of its own size,
+ * or given back if that bin is full or it is too large to cache, and the refill stops there. The bin may be left empty.
+ * @param size Node size the bin holds
+ * @param cache_bin Index of the bin
+ */
+void refill_cache(unsigned int size, int cache_bin)
+{
+	lock_heap();
+
+	int i;
+	for (i = 0; i < TCACHE_BATCH; i++)
+	{
+		cache_entry_t *entry = i == 0 ? allocate_or_reclaim(size) : allocate_block(size);
+		if (entry == NULL)	// out of memory, keep what we have
+		{
+			break;
+		}
+
+		unsigned int usable_size = slab_owns(entry) ? slab_usable_size(entry) : ((node_t*) entry - 1)->size;
+		int entry_bin = usable_size == size ? cache_bin : get_cache_bin(usable_size);
+		if (entry_bin < 0 || thread_cache.counts[entry_bin] >= TCACHE_MAX_COUNT)	// nowhere to keep it
+		{
+			release_block(entry);
+			break;
+		}
+
+		if (slab_owns(entry))	// so a free of it is caught while it sits in the cache
+		{
+			slab_mark_cached(entry);
+		}
+		entry->next = thread_cache.bins[entry_bin];
+		thread_cache.bins[entry_bin] = entry;
+		thread_cache.counts[entry_bin]++;
+
+		if (entry_bin != cache_bin)	// the heap has no more nodes of exactly this size to spare
+		{
+			break;
+		}
+	}
+
+	unlock_heap();
+}
+
+/*
+ * Returns blocks from a bin of a thread cache to the shared heap.
+ * The caller must hold the heap lock.
+ * @param *cache Thread cache to take the blocks from
+ * @param cache_bin Index of the bin
+ * @param count Most blocks to return
+ */
+void release_cache_bin(thread_cache_t *cache, int cache_bin, unsigned int count)
+{
+	while (count > 0 && cache->bins[cache_bin] != NULL)
+	{
+		cache_entry_t *entry = cache->bins[cache_bin];
+		cache->bins[cache_bin] = entry->next;
+		cache->counts[cache_bin]--;
+		count--;
+
+		if (slab_owns(entry))	// its slab would reject it while it is marked
+		{
+			slab_unmark_cached(entry);
+		}
+		release_block(entry);
+	}
+}
+
+/*
+ * Returns blocks from a bin of a thread cache to the shared heap, taking the lock once.
+ * @param *cache Thread cache to take the blocks from
+ * @param cache_bin Index of the bin
+ * @param count Most blocks to return
+ */
+void flush_cache_bin(thread_cache_t *cache, int cache_bin, unsigned int count)
+{
+	lock_heap();
+	release_cache_bin(cache, cache_bin, count);
+	unlock_heap();
+}
+
+/*
+ * Returns every block in a thread cache to the shared heap. Runs automatically when a thread exits.
+ * @param *cache Thread cache to empty
+ */
+void flush_cache(void *cache)
 {
-	node_t *new_node = (node_t*) &myblock[curr_mem_index];
+	if (((thread_cache_t*) cache)->owner != 0)	// blocks freed to this thread by others have nowhere else to go
+	{
+		close_owned_frees(cache);
+	}
 
-	new_node->size = size;
-	new_node->active = 0;
+	int i;
+	for (i = 0; i < TCACHE_NUM_BINS; i++)
+	{
+		flush_cache_bin(cache, i, TCACHE_MAX_COUNT);
+	}
 }
 
 /*
- * Sets up memory if mymalloc() has not been called previously.
- * Creates a single, inactive node encompassing all of memory.
- * If mymalloc() has been called in the past, nothing will be done.
+ * Pushes a freed node onto the remote free list with a CAS, without taking the heap lock.
+ * @param *entry Data of the node, which holds its link until the node is taken off the list
  */
-void initialize_malloc()
+void push_remote_free(cache_entry_t *entry)
 {
-	if (myblock[0] == '\0')	// memory is initialized to \0 prior to the creation of the first node
+	cache_entry_t *head = __atomic_load_n(&curr_heap->remote_free_list, __ATOMIC_RELAXED);
+
+	do
 	{
-		create_node(0, sizeof(myblock) - sizeof(node_t));
-	}
+		entry->next = head;
+	} while (!__atomic_compare_exchange_n(&curr_heap->remote_free_list, &head, entry, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));	// head is reloaded on failure
 }
 
 /*
- * Determines whether or not the space requested by the user is a valid request.
- * The user can request a minimum of 1 byte.
- * The maximal request is determined by subtracting the size of one metadata node from the size of the memory array.
- * @param request_size Amount of bytes requested by the user
- * @return True if the request is valid, and false otherwise
+ * Takes every node on the remote free list at once and frees it into the heap.
+ * The caller must hold the heap lock.
  */
-bool validate_request(size_t request_size, int line, char* filename)
+void drain_remote_frees()
 {
-	if (request_size < 1)	// checking if request is too small
+	if (__atomic_load_n(&curr_heap->remote_free_list, __ATOMIC_RELAXED) == NULL)	// usual case, no exchange needed
 	{
-		printf("Error at line %d in file %s: Request is too small! Minimum request: %d; your request: %d\n", line, filename, 1, request_size);
-		return false;
+		return;
 	}
-	else if (request_size > sizeof(myblock) - sizeof(node_t)) 	// check if the request is too big
-	{
 
-		printf("Error at line %d in file %s: Request is too large! Maximum request: %d; your request: %d\n", line, filename, sizeof(myblock) - sizeof(node_t), request_size);
-		return false;
+	cache_entry_t *entry = __atomic_exchange_n(&curr_heap->remote_free_list, NULL, __ATOMIC_ACQUIRE);
+	while (entry != NULL)
+	{
+		cache_entry_t *next = entry->next;	// the link lives in the node's data, read it before the node is freed
+		stat_add(remote_frees, 1);
+		free_node((int) ((char*) entry - curr_heap->block) - (int) sizeof(node_t));
+		entry = next;
 	}
-
-	return true;
 }
 
 /*
- * Calculates and returns the index of the next metadata node.
- * @param curr_mem_index Index in the memory array from which to begin counting
- * @return Index of the next metadata node
+ * Sets up the calling thread's cache the first time the thread allocates: makes sure it is flushed when the thread exits,
+ * and takes a free remote free list, so the thread can own blocks.
  */
-short get_next_index(short curr_mem_index)
+void register_cache()
 {
-	node_t *curr_node = (node_t*) &myblock[curr_mem_index];
-
-	short next_mem_index = curr_mem_index + curr_node->size + sizeof(node_t);	// calculate location of next node
+	pthread_once(&cache_key_once, create_cache_key);
+	pthread_setspecific(cache_key, &thread_cache);
+	thread_cache_registered = true;
 
-	if (next_mem_index >= sizeof(myblock) - sizeof(node_t)) // out of bounds!
+	int i;
+	for (i = 1; i <= TCACHE_MAX_OWNERS; i++)
 	{
-		return -1;
+		cache_entry_t *unowned = NULL;
+		if (__atomic_compare_exchange_n(&owned_frees[i], &unowned, &remote_list_end, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))	// opens the list
+		{
+			thread_cache.owner = i;
+			break;
+		}
 	}
+}
 
-	return next_mem_index;
+/*
+ * Looks up the thread that allocated a block of the default heap.
+ * @param *ptr Block within the heap or the slab area
+ * @return Index of the owner's remote free list, or 0 if the block has no owner
+ */
+int get_owner(void *ptr)
+{
+	return __atomic_load_n(&owner_map[((char*) ptr - myblock) / OWNER_GRANULE], __ATOMIC_RELAXED);
 }
 
 /*
- * Compares the current inactive node with the amount of requested space and determines an action.
- * @param curr_mem_index Index of the current node
- * @param request_size Amount of space requested
- * @return The first action that should be taken on the current node
+ * Records the calling thread as the owner of a block it is handing out from the default heap.
+ * @param *ptr Block within the heap or the slab area
  */
-action_type compare(short curr_mem_index, short request_size)
+void set_owner(void *ptr)
 {
-	node_t *curr_node = (node_t*) &myblock[curr_mem_index];
-	action_type result = ACTION_SKIP;
+	uint8_t *entry = &owner_map[((char*) ptr - myblock) / OWNER_GRANULE];
 
-	if (curr_node->size < request_size)	// node is too small
-	{
-		result = ACTION_SKIP;
-	}
-	else if (curr_node->size <= request_size && request_size <= curr_node->size + sizeof(node_t)	// node can accomodate requested data, but is too small to split
-			|| curr_mem_index + sizeof(node_t) + request_size >= sizeof(myblock) - sizeof(node_t))	// node can accomodate data, but there is not enough space in memory left to split
+	if (__atomic_load_n(entry, __ATOMIC_RELAXED) != thread_cache.owner)	// a thread reusing its own blocks leaves the map's cache lines shared
 	{
-		result = ACTION_FILL;
+		__atomic_store_n(entry, (uint8_t) thread_cache.owner, __ATOMIC_RELAXED);
 	}
-	else	// Node can accomodate data and has enough leftover space to birth a new, unused node
+}
+
+/*
+ * Pushes a block freed on another thread onto its owner's remote free list with a CAS, without taking any lock.
+ * @param *entry Block, which holds its link until the owner takes it off the list
+ * @param owner Index of the owner's list
+ * @return True if the block was pushed, false if the owner has exited and closed its list
+ */
+bool push_owned_free(cache_entry_t *entry, int owner)
+{
+	cache_entry_t *head = __atomic_load_n(&owned_frees[owner], __ATOMIC_RELAXED);
+
+	do
 	{
-		result = ACTION_SPLIT;
-	}
+		if (head == NULL)	// closed
+		{
+			return false;
+		}
+		entry->next = head;
+	} while (!__atomic_compare_exchange_n(&owned_frees[owner], &head, entry, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));	// head is reloaded on failure
 
-	return result;
+	return true;
 }
 
 /*
- * Splits a large node into two.
- * The first node is created with a specified size.
- * The second node is created out of the remaining space from the original node.
- * @param curr_mem_index Index of the large node that will be split
- * @param request_size Desired size of first node
+ * Takes every block other threads pushed onto the calling thread's remote free list at once.
+ * Blocks the cache has room for are filed in it. The others are given back to the shared heap, taking the lock once.
  */
-void split_node(short curr_mem_index, short request_size)
+void drain_owned_frees()
 {
-	node_t *first_node = (node_t*) &myblock[curr_mem_index];
+	cache_entry_t *entry = __atomic_exchange_n(&owned_frees[thread_cache.owner], &remote_list_end, __ATOMIC_ACQUIRE);
+	cache_entry_t *overflow = NULL;
 
-	short second_size = first_node->size - sizeof(node_t) - request_size;	// calculates size of second node from what will be left over after forming first node
+	while (entry != &remote_list_end)
+	{
+		cache_entry_t *next = entry->next;
+		stat_add(remote_frees, 1);
 
-	first_node->size = request_size;	// assigns first node its requested size
-	short second_node_index = get_next_index(curr_mem_index);	// sets the second node to begin at what is now unused memory
-	create_node(second_node_index, second_size);	// creates the second node, allowing you to navigate past it in the future
+		unsigned int usable_size;
+		if (slab_owns(entry))
+		{
+			usable_size = slab_slot_size(entry);	// the slot is still marked as cached
+		}
+		else
+		{
+			node_t header = *((node_t*) entry - 1);	// nodes before this one may update prev_active at any time, read the header once
+			usable_size = header.size;
+		}
+
+		int cache_bin = get_cache_bin(usable_size);
+		if (cache_bin > -1 && thread_cache.counts[cache_bin] < TCACHE_MAX_COUNT)	// in the state a cached block is in already
+		{
+			entry->next = thread_cache.bins[cache_bin];
+			thread_cache.bins[cache_bin] = entry;
+			thread_cache.counts[cache_bin]++;
+		}
+		else
+		{
+			entry->next = overflow;
+			overflow = entry;
+		}
+		entry = next;
+	}
 
+	if (overflow != NULL)
+	{
+		lock_heap();
+		while (overflow != NULL)
+		{
+			cache_entry_t *next = overflow->next;
+			if (slab_owns(overflow))	// its slab would reject it while it is marked
+			{
+				slab_unmark_cached(overflow);
+			}
+			release_block(overflow);
+			overflow = next;
+		}
+		unlock_heap();
+	}
 }
 
 /*
- * Returns a void pointer to the beginning of the user data associated with a metadata node.
- * @param curr_mem_index Index of the metadata node
- * @return Void pointer to user data
+ * Closes a thread's remote free list when the thread exits, and gives every block on it back to the shared heap.
+ * Later frees of the thread's blocks go through the shared heap, until another thread takes the list.
+ * @param *cache Cache of the exiting thread
  */
-void *get_data_ptr (short curr_mem_index)
+void close_owned_frees(thread_cache_t *cache)
 {
-	void *data_ptr = (void*) &myblock[curr_mem_index + sizeof(node_t)];
-	return data_ptr;
-}
+	cache_entry_t *entry = __atomic_exchange_n(&owned_frees[cache->owner], NULL, __ATOMIC_ACQ_REL);
+	cache->owner = 0;	// in case the thread allocates again on its way out
 
+	lock_heap();
+	while (entry != &remote_list_end)
+	{
+		cache_entry_t *next = entry->next;
+		stat_add(remote_frees, 1);
+		if (slab_owns(entry))
+		{
+			slab_unmark_cached(entry);
+		}
+		release_block(entry);
+		entry = next;
+	}
+	unlock_heap();
+}
 
 /*
- * Allocates space of requested size in "dynamic" memory.
- * @param request_size Amount of memory requested by user
- * @return Pointer to block of memory
+ * Frees a block allocated on another thread back to that thread, without taking the heap lock.
+ * Only the block map, or the block's slot, is checked, like free_to_cache() checks it.
+ * @param *ptr Pointer to free, already known to lie within the heap or the slab area
+ * @param owner Index of the owner's remote free list
+ * @return True if the block was freed or rejected with an error, false if it must be freed through the shared heap
  */
-void *mymalloc(size_t request_size, int line, char* filename)
+bool free_to_owner(void *ptr, int owner, int LINE, char *FILE)
 {
-	initialize_malloc();
-	if (!validate_request(request_size, line, filename))
+	unsigned int usable_size;
+	bool is_slot = slab_owns(ptr);
+
+	if (is_slot)
 	{
-		return NULL;
+		usable_size = slab_usable_size(ptr);	// 0 unless ptr is a slot that is handed out
+	}
+	else if (is_handed_out(ptr))
+	{
+		node_t header = *((node_t*) ptr - 1);
+		usable_size = header.size;
+	}
+	else
+	{
+		usable_size = 0;
 	}
 
-	short curr_mem_index = 0;
-	node_t *curr_node;
+	if (usable_size == 0)	// let the shared heap report it
+	{
+		return false;
+	}
 
-	while (curr_mem_index > -1)
+	if (is_slot ? !slab_mark_cached(ptr) : !unmark_handed_out(ptr))	// block was already freed, by a thread racing this one
 	{
-		curr_node = (node_t*) &myblock[curr_mem_index];
+		stat_add(failed_frees, 1);
+		report_error("Error at line %d in file %s: Pointer was already freed!\n", LINE, FILE);
+		return true;
+	}
 
-		if (!curr_node->active)	// decide on an action for an inactive node
-		{
-			action_type action = compare(curr_mem_index, request_size);
-			switch (action)
-			{
-				case ACTION_SPLIT:
-					split_node(curr_mem_index, request_size);
-				case ACTION_FILL:
-					curr_node->active = 1;
-					return get_data_ptr(curr_mem_index);
-				case ACTION_SKIP:
-					curr_mem_index = get_next_index(curr_mem_index);
-			}
-		}
-		else // node is active
+	stat_free(usable_size);
+	trace_free(ptr, LINE, FILE);
+	profile_free(ptr);
+
+	if (!push_owned_free(ptr, owner))	// owner has exited, give the block straight back
+	{
+		lock_heap();
+		if (is_slot)
 		{
-			curr_mem_index = get_next_index(curr_mem_index);
+			slab_unmark_cached(ptr);
 		}
-	} // end while
+		release_block(ptr);
+		unlock_heap();
+	}
 
-	printf("Error at line %d in file %s: Out of memory!\n", line, filename);
-	return NULL;
-} //end of mymalloc(size_t size)
+	return true;
+}
 
 /*
- * Determines whether or not a pointer lies within the memory array
- * @param *ptr Prospective pointer
- * @return True if pointer is within the array, false otherwise
+ * Attempts to free a block into the calling thread's cache, without taking the heap lock.
+ * Other threads may be changing the neighbouring nodes, so only the block map, or the block's slot, is checked here.
+ * @param *ptr Pointer to free, already known to lie within the heap or the slab area
+ * @return True if the block was cached or rejected with an error, false if it must be freed through the shared heap
  */
-bool validate_ptr(void *ptr)
+bool free_to_cache(void *ptr, int LINE, char *FILE)
 {
-	return (void*) myblock <= ptr && ptr <= (void*) &myblock[sizeof(myblock) - 1];
+	unsigned int usable_size;
+	bool is_slot = slab_owns(ptr);
+
+	if (is_slot)
+	{
+		usable_size = slab_usable_size(ptr);	// 0 unless ptr is a slot that is handed out
+	}
+	else if (is_handed_out(ptr))	// the header of a block that is handed out can be trusted
+	{
+		node_t header = *((node_t*) ptr - 1);	// nodes before this one may update prev_active at any time, read the header once
+		usable_size = header.size;
+	}
+	else
+	{
+		usable_size = 0;
+	}
+
+	if (usable_size == 0)	// let the shared heap report it
+	{
+		return false;
+	}
+
+	int cache_bin = get_cache_bin(usable_size);
+	if (cache_bin < 0)	// too large to cache
+	{
+		return false;
+	}
+
+	cache_entry_t *target_entry = ptr;
+
+	if (is_slot ? !slab_mark_cached(ptr) : !unmark_handed_out(ptr))	// block was already freed, into this thread's cache or another's
+	{
+		stat_add(failed_frees, 1);
+		report_error("Error at line %d in file %s: Pointer was already freed!\n", LINE, FILE);
+		return true;
+	}
+
+	stat_free(usable_size);
+	trace_free(ptr, LINE, FILE);
+	profile_free(ptr);
+
+	target_entry->next = thread_cache.bins[cache_bin];
+	thread_cache.bins[cache_bin] = target_entry;
+	thread_cache.counts[cache_bin]++;
+
+	if (thread_cache.counts[cache_bin] > TCACHE_MAX_COUNT)	// bin is full, give a batch back to the shared heap
+	{
+		flush_cache_bin(&thread_cache, cache_bin, TCACHE_BATCH);
+	}
+
+	return true;
 }
+#endif
 
 /*
- * Merges two nodes.
- * The first node absorbs the second node, creating one large node.
- * @param first_index Index of the first node
- * @param second_index Index of the second node
+ * Determines which size class a block is counted in.
+ * @param usable_size Usable size of the block
+ * @return Index of the size class
  */
-void merge_two_nodes(short first_index, short second_index)
+int get_stats_class(size_t usable_size)
 {
-	node_t *first_node = (node_t*) &myblock[first_index];
-	node_t *second_node = (node_t*) &myblock[second_index];
+	if (usable_size <= 1)
+	{
+		return 0;
+	}
+	if (usable_size > (size_t) 1 << (STATS_NUM_CLASSES - 1))	// huge blocks past the last class are counted in it
+	{
+		return STATS_NUM_CLASSES - 1;
+	}
 
-	short combined_size = first_node->size + sizeof(node_t) + second_node->size;
-	first_node->size = combined_size;	// overwrites second node
+	return 64 - __builtin_clzll(usable_size - 1);	// smallest k with usable_size <= 2^k
 }
 
+#ifdef MYMALLOC_STATS
 /*
- * Attempts to combine the current node with the node before and after it.
- * Nodes can only be combined if they are both inactive.
- * @param prev_mem_index Index of the previous node
- * @param curr_mem_index Index of the current node
- * @param next_mem_index Index of the next node
+ * Counts a block handed out to the user, and raises the peak if needed.
+ * @param usable_size Usable size of the block
  */
-void combine_nodes(short prev_mem_index, short curr_mem_index, short next_mem_index)
+void record_alloc(size_t usable_size)
 {
-	node_t *adjacent_node;
-	if (next_mem_index > -1)	// next node exists
+	size_t live_bytes = __atomic_add_fetch(&heap_stats.live_bytes, usable_size, __ATOMIC_RELAXED);
+	size_t peak_bytes = __atomic_load_n(&heap_stats.peak_bytes, __ATOMIC_RELAXED);
+
+	while (live_bytes > peak_bytes && !__atomic_compare_exchange_n(&heap_stats.peak_bytes, &peak_bytes, live_bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))	// another thread may raise it first
 	{
-		adjacent_node = (node_t*) &myblock[next_mem_index];
-		if (!adjacent_node->active)	// next node is also inactive, join them!
-		{
-			merge_two_nodes(curr_mem_index, next_mem_index);
-		}
 	}
-	
-	if (prev_mem_index > -1)	// previous node exists
+
+	stat_add(alloc_counts[get_stats_class(usable_size)], 1);
+}
+
+/*
+ * Counts a block the user gave back.
+ * @param usable_size Usable size of the block, or 0 if it turned out not to be handed out, in which case nothing is counted
+ */
+void record_free(size_t usable_size)
+{
+	if (usable_size > 0)
 	{
-		adjacent_node = (node_t*) &myblock[prev_mem_index];
-		if (!adjacent_node->active)	// previous node is inactive, join them!!
-		{
-			merge_two_nodes(prev_mem_index, curr_mem_index);
-		}
+		stat_add(live_bytes, -(size_t) usable_size);
+		stat_add(free_counts[get_stats_class(usable_size)], 1);
 	}
 }
 
 /*
- * Frees a block of dynamically allocated memory for future use.
- * Freed memory cannot be accessed.
- * @param *ptr Pointer to a previous allocation performed by mymalloc()
+ * Counts one search of the heap for an inactive node, along with the nodes it looked at since the last search.
  */
-void myfree(void *ptr, int LINE, char *FILE)
+void record_search()
 {
+	stat_add(searches, 1);	// each heap has its own lock, so searches of different heaps may finish at the same time
+	stat_add(nodes_traversed, search_nodes);
 
-	if(ptr == NULL)
+	unsigned long max_nodes = __atomic_load_n(&heap_stats.max_nodes_traversed, __ATOMIC_RELAXED);
+	while (search_nodes > max_nodes && !__atomic_compare_exchange_n(&heap_stats.max_nodes_traversed, &max_nodes, search_nodes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
 	{
-		printf("Error at line %d in file %s: Cannot free a NULL pointer\n", LINE, FILE);
-		return;
 	}
+	search_nodes = 0;
+}
+#endif
 
-	if (!validate_ptr(ptr))	// check that address is within our memory array
+/*
+ * Copies the allocator's counters, without walking the heap.
+ * @param *stats Filled in with the counters, or with zeros if statistics are compiled out
+ * @return True if statistics are enabled, false otherwise
+ */
+bool mymalloc_get_stats(mymalloc_stats_t *stats)
+{
+#ifdef MYMALLOC_STATS
+	lock_heap();
+	*stats = heap_stats;
+	unlock_heap();
+	return true;
+#else
+	memset(stats, 0, sizeof(mymalloc_stats_t));
+	return false;
+#endif
+}
+
+/*
+ * Prints out the nodes of our memory array.
+ */
+void print_memory()
+{
+	int curr_mem_index = curr_heap->block != NULL ? 0 : -1;	// nothing to print before the heap is set up
+	node_t *curr_node;
+
+	lock_heap();
+
+	while (curr_mem_index > -1)
 	{
-		printf("Error at line %d in file %s: Argument is not an address within the heap\n", LINE, FILE);
-		return;
+		curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+		printf("Size = %d, Active = %d ---> ", curr_node->size, curr_node->active);
+
+		curr_mem_index = get_next_index(curr_mem_index);
 	}
 
-	node_t *target_node = (node_t*) (ptr - sizeof(node_t));	// we will attempt to free this node
-	node_t *curr_node;	// use this node to search for target
+	unlock_heap();
+	printf("\n");
+}
+
+/*
+ * Walks the heap and measures how its free space is laid out.
+ * @param *analysis Filled in with the results, or with zeros if the heap has not been set up
+ */
+void analyze_heap(heap_analysis_t *analysis)
+{
+	memset(analysis, 0, sizeof(heap_analysis_t));
 
-	short prev_mem_index = -1;	// track preceding node 
-	short curr_mem_index = 0;
+	lock_heap();
 
+	int curr_mem_index = curr_heap->block != NULL ? 0 : -1;	// nothing to analyze before the heap is set up
 	while (curr_mem_index > -1)
 	{
-		curr_node = (node_t*) &myblock[curr_mem_index];
-		
-		if (curr_node == target_node)	// Found node
+		node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+
+		analysis->num_nodes++;
+		if (curr_node->active)
+		{
+			analysis->active_bytes += curr_node->size;
+		}
+		else
 		{
-			if (!curr_node->active)	// node was already freed
+			analysis->num_free_nodes++;
+			analysis->free_bytes += curr_node->size;
+			analysis->free_histogram[get_stats_class(curr_node->size)]++;
+			if (curr_node->size > analysis->largest_free)
 			{
-				printf("Error at line %d in file %s: Pointer was already freed!\n", LINE, FILE);
-				return;
+				analysis->largest_free = curr_node->size;
 			}
-			curr_node->active = 0;	// set inactive - do not need to clear out data
-			combine_nodes(prev_mem_index, curr_mem_index, get_next_index(curr_mem_index)); // check adjacent nodes
-			return;
 		}
 
-		prev_mem_index = curr_mem_index;
 		curr_mem_index = get_next_index(curr_mem_index);
 	}
-	
-	// not found? data was not a pointer
-	printf("Error at line %d in file %s: Argument is not a pointer returned by malloc()\n", LINE, FILE);
 
-	return;
-} //end of myfree(void * freePtr)
+	analysis->heap_size = curr_heap->heap_size;
+	analysis->slack_bytes = curr_heap->slack_bytes;
+
+	unlock_heap();
+
+	if (analysis->free_bytes > 0)
+	{
+		analysis->external_fragmentation = 1.0 - (double) analysis->largest_free / analysis->free_bytes;
+	}
+	if (analysis->heap_size > 0)
+	{
+		analysis->header_overhead = 100.0 * analysis->num_nodes * sizeof(node_t) / analysis->heap_size;
+	}
+}
 
 /*
- * Prints out the nodes of our memory array.
+ * Analyzes the heap and writes the results in a machine-readable format.
+ * @param *out Stream to write to
+ * @param format FORMAT_JSON or FORMAT_CSV
  */
-void print_memory()
+void export_heap_analysis(FILE *out, analysis_format format)
 {
-	short curr_mem_index = 0;
-	node_t *curr_node;
+	heap_analysis_t analysis;
+	analyze_heap(&analysis);
 
-	while (curr_mem_index > -1)
+	int i;
+	if (format == FORMAT_JSON)
 	{
-		curr_node = (node_t*) &myblock[curr_mem_index];
+		fprintf(out, "{\"heap_size\": %zu, \"num_nodes\": %lu, \"num_free_nodes\": %lu, ", analysis.heap_size, analysis.num_nodes, analysis.num_free_nodes);
+		fprintf(out, "\"active_bytes\": %zu, \"free_bytes\": %zu, \"largest_free\": %zu, ", analysis.active_bytes, analysis.free_bytes, analysis.largest_free);
+		fprintf(out, "\"external_fragmentation\": %.4f, \"header_overhead_percent\": %.2f, \"slack_bytes\": %zu, ",
+				analysis.external_fragmentation, analysis.header_overhead, analysis.slack_bytes);
+		fprintf(out, "\"free_histogram\": [");
 
-		printf("Size = %d, Active = %d ---> ", curr_node->size, curr_node->active);
+		bool first = true;
+		for (i = 0; i < STATS_NUM_CLASSES; i++)	// only the size classes that have free nodes
+		{
+			if (analysis.free_histogram[i] > 0)
+			{
+				fprintf(out, "%s{\"up_to\": %u, \"count\": %lu}", first ? "" : ", ", 1U << i, analysis.free_histogram[i]);
+				first = false;
+			}
+		}
+		fprintf(out, "]}\n");
+	}
+	else
+	{
+		fprintf(out, "metric,value\n");
+		fprintf(out, "heap_size,%zu\nnum_nodes,%lu\nnum_free_nodes,%lu\n", analysis.heap_size, analysis.num_nodes, analysis.num_free_nodes);
+		fprintf(out, "active_bytes,%zu\nfree_bytes,%zu\nlargest_free,%zu\n", analysis.active_bytes, analysis.free_bytes, analysis.largest_free);
+		fprintf(out, "external_fragmentation,%.4f\nheader_overhead_percent,%.2f\nslack_bytes,%zu\n",
+				analysis.external_fragmentation, analysis.header_overhead, analysis.slack_bytes);
+
+		for (i = 0; i < STATS_NUM_CLASSES; i++)
+		{
+			if (analysis.free_histogram[i] > 0)
+			{
+				fprintf(out, "free_nodes_up_to_%u,%lu\n", 1U << i, analysis.free_histogram[i]);
+			}
+		}
+	}
+}
 
+/*
+ * Writes every node of the heap as CSV, one "index,size,active" line per node after a header line.
+ * @param *out Stream to write to
+ */
+void export_heap_map(FILE *out)
+{
+	int curr_mem_index = curr_heap->block != NULL ? 0 : -1;	// nothing to write before the heap is set up
+
+	fprintf(out, "index,size,active\n");
+	lock_heap();
+
+	while (curr_mem_index > -1)
+	{
+		node_t *curr_node = (node_t*) &curr_heap->block[curr_mem_index];
+		fprintf(out, "%d,%u,%d\n", curr_mem_index, curr_node->size, curr_node->active);
 		curr_mem_index = get_next_index(curr_mem_index);
 	}
 
-	printf("\n");
+	unlock_heap();
 }
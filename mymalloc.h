@@ -11,26 +11,343 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef MYMALLOC_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #define malloc(x) mymalloc(x, __LINE__, __FILE__)
 #define free(x) myfree(x, __LINE__, __FILE__)
+#define calloc(n, x) mycalloc(n, x, __LINE__, __FILE__)
+#define realloc(p, x) myrealloc(p, x, __LINE__, __FILE__)
+#define aligned_alloc(a, x) myaligned_alloc(a, x, __LINE__, __FILE__)
+#define malloc_batch(n, x, out) mymalloc_batch(n, x, out, __LINE__, __FILE__)
+#define free_batch(ptrs, n) myfree_batch(ptrs, n, __LINE__, __FILE__)
+#define heap_create(x) myheap_create(x, __LINE__, __FILE__)
+#define heap_alloc(heap, x) myheap_alloc(heap, x, __LINE__, __FILE__)
+#define heap_free(heap, p) myheap_free(heap, p, __LINE__, __FILE__)
+#define heap_destroy(heap) myheap_destroy(heap, __LINE__, __FILE__)
+
+/*
+ * Size of the heap when mymalloc() is first called, in bytes.
+ * Can be set at build time with -DMYMALLOC_HEAP_SIZE=<bytes>, or at run time with mymalloc_init().
+ * It is rounded up to a whole number of pages.
+ */
+#ifndef MYMALLOC_HEAP_SIZE
+#define MYMALLOC_HEAP_SIZE 8192
+#endif
+
+/*
+ * Size the heap is allowed to grow to when it runs out of memory, in bytes.
+ * Defaults to MYMALLOC_HEAP_SIZE, meaning the heap never grows and mymalloc() reports that it is out of memory instead.
+ */
+#ifndef MYMALLOC_MAX_HEAP_SIZE
+#define MYMALLOC_MAX_HEAP_SIZE MYMALLOC_HEAP_SIZE
+#endif
+
+/*
+ * Smallest region added to the heap each time it grows, in bytes.
+ * Growing in large steps keeps the number of mprotect() calls low.
+ */
+#ifndef MYMALLOC_REGION_SIZE
+#define MYMALLOC_REGION_SIZE (64 * 1024)
+#endif
+
+/*
+ * Smallest request, in bytes after rounding, that gets a mapping of its own instead of a node, see huge.h.
+ * Huge blocks are unmapped as soon as they are freed, so they never fragment the heap or lengthen its searches, and are not limited by its size.
+ */
+#ifndef MYMALLOC_HUGE_THRESHOLD
+#define MYMALLOC_HUGE_THRESHOLD (128 * 1024)
+#endif
+
+/*
+ * Bytes returned to the heap after which the whole pages inside its inactive nodes are given back to the operating system with madvise().
+ * Pages given back are faulted in again, zeroed, when a node that covers them is handed out, so the heap's resident memory shrinks after a spike.
+ * Can be set at build time with -DMYMALLOC_TRIM_THRESHOLD=<bytes>, where 0 only trims when mymalloc_trim() is called.
+ */
+#ifndef MYMALLOC_TRIM_THRESHOLD
+#define MYMALLOC_TRIM_THRESHOLD (256 * 1024)
+#endif
+
+/*
+ * Placement policy used to choose which inactive node serves a request, see placement_policy.
+ * Can be set at build time with -DMYMALLOC_POLICY=<policy>, or at run time with mymalloc_set_policy().
+ */
+#ifndef MYMALLOC_POLICY
+#define MYMALLOC_POLICY POLICY_SEGREGATED_FIT
+#endif
+
+/*
+ * Whether myfree() puts nodes in the quick lists instead of coalescing them, see DEFER_MAX_SIZE.
+ * Can be set at build time with -DMYMALLOC_DEFER_COALESCE=1, or at run time with mymalloc_set_deferred_coalescing().
+ */
+#ifndef MYMALLOC_DEFER_COALESCE
+#define MYMALLOC_DEFER_COALESCE 0
+#endif
+
+/*
+ * Name of the build configuration, for reports: its mode, its backend and its node layout, such as "release/buddy/align16".
+ * Debug builds, enabled with -DMYMALLOC_DEBUG, guard every block, see guard_t.
+ * Release builds, enabled with -DMYMALLOC_RELEASE, are meant to be optimized, and reject bad calls without printing an error.
+ * The backend is "nodes" for the node allocator, or "buddy" for the buddy system enabled with -DMYMALLOC_BUDDY.
+ * The layout is "align4", or "align16" with -DMYMALLOC_ALIGN16, see NODE_ALIGNMENT.
+ */
+#if defined(MYMALLOC_DEBUG)
+#define MYMALLOC_BUILD_MODE "debug"
+#elif defined(MYMALLOC_RELEASE)
+#define MYMALLOC_BUILD_MODE "release"
+#else
+#define MYMALLOC_BUILD_MODE "default"
+#endif
+
+#ifdef MYMALLOC_BUDDY
+#define MYMALLOC_BUILD_BACKEND "buddy"
+#else
+#define MYMALLOC_BUILD_BACKEND "nodes"
+#endif
+
+#ifdef MYMALLOC_ALIGN16
+#define MYMALLOC_BUILD_LAYOUT "align16"
+#else
+#define MYMALLOC_BUILD_LAYOUT "align4"
+#endif
+
+#define MYMALLOC_BUILD MYMALLOC_BUILD_MODE "/" MYMALLOC_BUILD_BACKEND "/" MYMALLOC_BUILD_LAYOUT
+
+/*
+ * Reports a bad call. Shared by every part of the library, so arenas report their errors the same way as the heap.
+ */
+#if defined(MYMALLOC_RELEASE)
+#define report_error(...) ((void) sizeof(printf(__VA_ARGS__)))	// bad calls still fail, the message is only type-checked and never formatted
+#elif defined(MYMALLOC_PRELOAD)
+#define report_error(...) fprintf(stderr, __VA_ARGS__)	// stdout belongs to the program the library is preloaded into
+#else
+#define report_error(...) printf(__VA_ARGS__)
+#endif
+
+/*
+ * Largest alignment myaligned_alloc() accepts, one page.
+ */
+#define MAX_ALIGNMENT 4096
+
+/*
+ * Hard upper bound on the size of the heap.
+ * Node sizes are 30 bits wide, and node indices are ints.
+ */
+#define HEAP_SIZE_LIMIT (1UL << 30)
+
+/*
+ * This array will represent the default heap, see heap_t.
+ * All dynamic memory from malloc() will be allocated on this array.
+ * The whole maximum heap size is reserved with mmap() on the first call to mymalloc(), but only the first heap_size bytes are usable.
+ * Growing the heap makes the next region of the reservation usable, so nodes never move and indices stay valid.
+ */
+extern char *myblock;
 
 /*
- * This array will represent the heap.
- * All dynamic memory will be allocated on this array.
- * The elements are initialized to '\0'
+ * Links to neighbouring inactive nodes.
+ * An inactive node has no user data, so these are stored at the start of its data section, or in its header in aligned layout mode.
+ * Each inactive node belongs to exactly one bin, which is a doubly linked list of inactive nodes of similar size.
  */
-static char myblock[4096] = {'\0'};
+typedef struct free_links_t {
+	int prev_index;	// Index of the previous inactive node in the same bin, or -1 if this is the first one.
+	int next_index;	// Index of the next inactive node in the same bin, or -1 if this is the last one.
+} free_links_t;
 
 /*
  * A node of metadata.
  * Each allocated entity will be associated with a node.
+ *
+ * Aligned layout mode, enabled by building with -DMYMALLOC_ALIGN16, pads the header to 16 bytes, so every payload is 16-byte aligned.
+ * The padding holds the free links, so walking a bin reads one 16-byte header per node, which never straddles a cache line,
+ * and never touches the data the user last wrote. Every block costs 12 more bytes of header in exchange.
  */
 typedef struct node_t {
-	unsigned short size : 12;	// Represents space set aside for the user data. Also used for traversal.
+	unsigned int size : 30;	// Represents space set aside for the user data. Also used for traversal.
 	bool active : 1;	// True if the node is actively storing data and false otherwise.
+	bool prev_active : 1;	// True if the node directly before this one is active, or if this is the first node.
+#ifdef MYMALLOC_ALIGN16
+	free_links_t links;	// Valid only while the node is inactive.
+	unsigned int reserved;	// Pads the header to 16 bytes.
+#endif
 } node_t;
 
+/*
+ * Boundary tag written at the very end of an inactive node's data section.
+ * It holds a copy of the node's size, so the node after it can find where it starts without walking from index 0.
+ * The tag is only valid while the node is inactive, which is the only time anyone reads it (see node_t::prev_active).
+ */
+typedef unsigned int footer_t;
+
+/*
+ * Record at the very end of every block in debug builds. The bytes between the end of the request and the record are filled with CANARY_BYTE.
+ * Freeing a block checks that they are intact, and reports the call that allocated a block that was written past its end.
+ * round_request() makes room for at least GUARD_SIZE bytes after every request.
+ */
+typedef struct guard_t {
+	size_t request_size;	// Bytes the user asked for
+	int line;	// Line of the call that allocated the block
+	char *filename;	// File of the call that allocated the block
+} guard_t;
+
+#define CANARY_BYTE 0xA5
+#define CANARY_SIZE 4
+#define GUARD_SIZE (CANARY_SIZE + sizeof(guard_t))
+
+/*
+ * Every node must be able to hold its free links and its boundary tag once it becomes inactive.
+ * Smaller requests are rounded up to this size.
+ * In aligned layout mode the links are in the header, and the boundary tag is rounded up to keep payloads aligned.
+ */
+#ifdef MYMALLOC_ALIGN16
+#define MIN_PAYLOAD_SIZE NODE_ALIGNMENT
+#else
+#define MIN_PAYLOAD_SIZE (sizeof(free_links_t) + sizeof(footer_t))
+#endif
+
+/*
+ * Node sizes are rounded up to a multiple of this, so every node starts at an aligned index.
+ * It is also the alignment of every payload, since the header is this size too.
+ * myfree() uses this to reject pointers into the middle of a node without searching for it.
+ */
+#define NODE_ALIGNMENT sizeof(node_t)
+
+/*
+ * Inactive nodes are sorted into bins with a two-level index, so the smallest bin that fits a request is found in a few instructions.
+ * The first level splits sizes into powers of two, and the second level splits each power of two into SL_INDEX_COUNT equal ranges.
+ * Nodes smaller than SMALL_NODE_SIZE all share the first first-level index, with one bin per NODE_ALIGNMENT bytes.
+ * A bitmap for each level records which bins are non-empty.
+ */
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + 2)	// 2 = log2(NODE_ALIGNMENT)
+#define SMALL_NODE_SIZE (1 << FL_INDEX_SHIFT)
+#define FL_INDEX_MAX 30	// node sizes are 30 bits wide
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+
+/*
+ * Number of bins inactive nodes are sorted into, one per pair of first- and second-level indices.
+ * Bin fl * SL_INDEX_COUNT + sl holds the nodes with first-level index fl and second-level index sl.
+ */
+#define NUM_BINS (FL_INDEX_COUNT * SL_INDEX_COUNT)
+
+/*
+ * Thread-safe mode, enabled by building with -DMYMALLOC_THREAD_SAFE.
+ * Each thread keeps a cache of recently freed small blocks, so most calls never touch the shared heap or the slabs.
+ * The shared heap and the slabs are protected by a single lock, which is only taken when a cache has to be refilled or flushed,
+ * and to allocate blocks too large to be cached.
+ * Every block of the default heap remembers the thread that allocated it, its owner. A block freed on any other thread is pushed
+ * onto its owner's lock-free remote free list with a CAS, and the owner drains the list in its next mymalloc(), filing small blocks
+ * in its cache and giving the rest back to the shared heap under one lock. Blocks never move to the cache of the thread that frees them.
+ * A thread freeing a node it allocated, too large to be cached, never waits for the lock either. If the lock is free, the node is freed
+ * under it right away. Otherwise it is pushed onto its heap's remote free list, and whichever thread takes that heap's lock next frees it.
+ * Heaps from heap_create() have locks of their own and no owners, so a node freed from one takes that path, whichever thread frees it.
+ */
+
+/*
+ * Largest usable block size kept in the thread caches.
+ */
+#define TCACHE_MAX_SIZE 256
+
+/*
+ * Number of thread cache bins. Each bin holds blocks, slots or nodes, of exactly one usable size, up to TCACHE_MAX_SIZE.
+ */
+#define TCACHE_NUM_BINS ((int) (TCACHE_MAX_SIZE / NODE_ALIGNMENT))
+
+/*
+ * Number of blocks moved between a thread cache bin and the shared heap each time the lock is taken.
+ */
+#define TCACHE_BATCH 16
+
+/*
+ * Most blocks a thread cache bin may hold. Freeing into a full bin returns TCACHE_BATCH blocks to the shared heap.
+ */
+#define TCACHE_MAX_COUNT (2 * TCACHE_BATCH)
+
+/*
+ * Most threads that own blocks at once, one remote free list each. Threads past this own none,
+ * and other threads free their blocks through the shared heap. A thread that exits hands its list to the next thread to start.
+ */
+#define TCACHE_MAX_OWNERS 255
+
+/*
+ * Bytes of the default heap and the slab area per entry of the owner map. Every block can hold a cache_entry_t in thread-safe mode,
+ * so no two blocks start within the same granule.
+ */
+#define OWNER_GRANULE sizeof(cache_entry_t)
+
+/*
+ * Deferred coalescing.
+ * With it enabled, myfree() does not merge a node with its neighbours. The node stays active and goes on a quick list of nodes of exactly its size,
+ * and the next request of that size takes it back without searching the bins or splitting anything.
+ * The quick lists are merged into the heap in one pass when a request finds no node that fits, or when they hold DEFER_MAX_BLOCKS nodes.
+ * The buddy system never uses them: its blocks are powers of two and rounded requests are not, so no request would take a block back.
+ */
+
+/*
+ * Largest node size kept in the quick lists. Larger nodes are coalesced as soon as they are freed.
+ */
+#define DEFER_MAX_SIZE 1024
+
+/*
+ * Number of quick lists, one for every node size up to DEFER_MAX_SIZE.
+ */
+#define DEFER_NUM_BINS ((int) (DEFER_MAX_SIZE / NODE_ALIGNMENT))
+
+/*
+ * Most nodes the quick lists may hold together. Freeing one more runs the merge pass.
+ */
+#define DEFER_MAX_BLOCKS 256
+
+/*
+ * A cached block. Cached blocks stay active in the shared heap, so their data section is free to hold the link.
+ */
+typedef struct cache_entry_t {
+	struct cache_entry_t *next;	// Next cached block of the same size, or NULL
+} cache_entry_t;
+
+/*
+ * A thread's cache of blocks, indexed by get_cache_bin().
+ */
+typedef struct thread_cache_t {
+	cache_entry_t *bins[TCACHE_NUM_BINS];	// Singly linked lists of cached blocks
+	unsigned int counts[TCACHE_NUM_BINS];	// Number of blocks in each list
+	int owner;	// Index of the thread's remote free list, the owner recorded for its blocks, or 0 if it owns none
+} thread_cache_t;
+
+/*
+ * A heap: a reservation whose usable part is carved into nodes, with its own bins, quick lists, block map and lock.
+ * malloc() and the other calls without a heap handle use the default heap, whose reservation starts at myblock.
+ * heap_create() makes more, each in a reservation of its own, so a subsystem's blocks sit together, never wait on another heap's lock,
+ * and can all be freed at once by heap_destroy(). Slabs, huge blocks and thread caches only serve the default heap,
+ * since their memory lies outside the reservation, and requests from other heaps always get a node.
+ */
+typedef struct heap_t {
+	char *block;	// Start of the heap
+	size_t heap_size;	// Bytes at the start of block that are currently usable
+	size_t heap_limit;	// Bytes reserved for block, the most heap_size can grow to
+	size_t reserve_size;	// Bytes of the whole reservation, unmapped by heap_destroy(), or 0 for the default heap
+	uint64_t *block_map;	// One bit per NODE_ALIGNMENT bytes of the reservation, set while a block whose data starts there is handed out
+	int free_bins[NUM_BINS];	// Heads of the bins of inactive nodes, indexed by get_bin(), or -1 for an empty bin
+	unsigned int fl_bitmap;	// Bit fl is set if any bin with first-level index fl is non-empty
+	unsigned int sl_bitmap[FL_INDEX_COUNT];	// Bit sl of sl_bitmap[fl] is set if bin fl * SL_INDEX_COUNT + sl is non-empty
+	int quick_bins[DEFER_NUM_BINS];	// Heads of the quick lists, indexed by get_quick_bin(), or -1 for an empty list
+	unsigned int quick_count;	// Nodes the quick lists hold together
+	size_t freed_since_trim;	// Bytes returned to the heap since it was last trimmed, see MYMALLOC_TRIM_THRESHOLD
+	int next_fit_index;	// Node the last next fit search ended at. merge_two_nodes() moves it to the surviving node.
+	bool tail_active;	// True if the last node is active, which has no node after it to keep a prev_active flag
+	size_t slack_bytes;	// Bytes of blocks still handed out beyond their rounded requests because a node was filled instead of split, or a buddy block was larger
+	uint64_t *slack_map;	// One bit per NODE_ALIGNMENT bytes of the reservation, set where the request of a block counted in slack_bytes ends
+	int untouched_index;	// Every byte from here to the end of the heap is still zero, apart from the inactive node's header, links and tag
+#ifdef MYMALLOC_THREAD_SAFE
+	pthread_mutex_t lock;	// Protects every node of the heap
+	cache_entry_t *remote_free_list;	// Nodes freed without the lock, waiting for the next thread that takes it
+#endif
+	struct heap_t *next;	// Next heap made by heap_create(), so heap_destroy() can tell a handle it made and fork() can hold every lock
+} heap_t;
+
 /*
  * A type that represents an action to be taken on a node.
  * ACTION_FILL dictates that a node should be activated and its size kept the same.
@@ -40,59 +357,465 @@ typedef struct node_t {
 enum _action_type {ACTION_FILL, ACTION_SPLIT, ACTION_SKIP};
 typedef enum _action_type action_type;
 
+/*
+ * A type that represents how mymalloc() chooses among the inactive nodes that fit a request.
+ * Every policy uses the same bins, and the same code to split and coalesce nodes.
+ * POLICY_SEGREGATED_FIT takes the first node of the smallest non-empty bin that is guaranteed to fit, found with the bitmaps.
+ * POLICY_FIRST_FIT takes the inactive node that fits with the lowest address.
+ * POLICY_NEXT_FIT takes the first inactive node that fits, starting from where the last search ended and wrapping around.
+ * POLICY_BEST_FIT takes the smallest inactive node that fits. Bins are kept sorted by size, so the search stops at the first fit.
+ */
+enum _placement_policy {POLICY_SEGREGATED_FIT, POLICY_FIRST_FIT, POLICY_NEXT_FIT, POLICY_BEST_FIT, NUM_POLICIES};
+typedef enum _placement_policy placement_policy;
+
+/*
+ * Allocator statistics, enabled by building with -DMYMALLOC_STATS.
+ * Counters are updated as blocks are handed out and freed, so reading them never walks the heap.
+ * Without MYMALLOC_STATS every stat_*() call compiles to nothing, and mymalloc_get_stats() reports all zeros.
+ */
+
+/*
+ * Number of size classes allocations and frees are counted in. Class k holds usable sizes from 2^(k-1) + 1 to 2^k.
+ * The last class also holds every huge block larger than that.
+ */
+#define STATS_NUM_CLASSES 31
+
+/*
+ * Counters kept by the allocator. Byte counts are usable sizes, which may be larger than what was asked for.
+ * A block sitting in a thread cache counts as freed, since the user no longer holds it.
+ * Heaps from heap_create() are counted together with the default heap, and destroying a heap counts its blocks as freed.
+ */
+typedef struct mymalloc_stats_t {
+	size_t live_bytes;	// Bytes handed out and not yet freed
+	size_t peak_bytes;	// Most bytes handed out at the same time
+	unsigned long alloc_counts[STATS_NUM_CLASSES];	// Successful mymalloc() calls, by size class
+	unsigned long free_counts[STATS_NUM_CLASSES];	// Successful myfree() calls, by size class
+	unsigned long searches;	// Searches of the heap for an inactive node
+	unsigned long nodes_traversed;	// Nodes looked at by all searches together
+	unsigned long max_nodes_traversed;	// Most nodes looked at by a single search
+	unsigned long splits;	// Nodes or buddy blocks split in two
+	unsigned long merges;	// Pairs of nodes or buddy blocks merged into one
+	unsigned long quick_reuses;	// Requests served from a quick list, see DEFER_MAX_SIZE
+	unsigned long merge_passes;	// Times the quick lists were merged into the heap
+	unsigned long remote_frees;	// Blocks taken off the remote free lists in thread-safe mode
+	unsigned long huge_maps;	// Blocks given a mapping of their own, see MYMALLOC_HUGE_THRESHOLD
+	unsigned long trim_passes;	// Times the heap was trimmed, see MYMALLOC_TRIM_THRESHOLD
+	size_t trimmed_bytes;	// Bytes given back to the operating system by all trims together, counting pages given back again each time
+	unsigned long failed_allocs;	// mymalloc() calls that returned NULL
+	unsigned long failed_frees;	// myfree() calls that were rejected with an error
+} mymalloc_stats_t;
+
+/*
+ * Snapshot of the default heap's layout, filled in by analyze_heap() by walking every node.
+ * Only the heap is covered, slabs, huge blocks and heaps from heap_create() are not. Nodes sitting in quick lists count as active, and so do blocks sitting in thread caches in thread-safe mode.
+ * The remote free list is emptied first.
+ */
+typedef struct heap_analysis_t {
+	size_t heap_size;	// Usable bytes in the heap
+	unsigned long num_nodes;	// Nodes, active and inactive
+	unsigned long num_free_nodes;	// Inactive nodes
+	size_t active_bytes;	// Total size of the active nodes' data sections
+	size_t free_bytes;	// Total size of the inactive nodes' data sections
+	size_t largest_free;	// Size of the largest inactive node, the largest request that can succeed without growing the heap
+	double external_fragmentation;	// 1 - largest_free / free_bytes, or 0 if nothing is free
+	double header_overhead;	// Percentage of the heap taken up by node headers
+	size_t slack_bytes;	// Bytes of blocks still handed out beyond what was asked for, because a node was filled instead of split or a buddy block was larger
+	unsigned long free_histogram[STATS_NUM_CLASSES];	// Inactive nodes by size class, see get_stats_class()
+} heap_analysis_t;
+
+/*
+ * Output formats for export_heap_analysis().
+ * FORMAT_JSON writes a single JSON object.
+ * FORMAT_CSV writes one "metric,value" line per number, after a header line.
+ */
+enum _analysis_format {FORMAT_JSON, FORMAT_CSV};
+typedef enum _analysis_format analysis_format;
+
+#ifdef MYMALLOC_STATS
+extern mymalloc_stats_t heap_stats;
+
+#define stat_add(field, amount) __atomic_fetch_add(&heap_stats.field, amount, __ATOMIC_RELAXED)
+#define stat_alloc(usable_size) record_alloc(usable_size)
+#define stat_free(usable_size) record_free(usable_size)
+#define stat_search() record_search()
+#else
+#define stat_add(field, amount)
+#define stat_alloc(usable_size)
+#define stat_free(usable_size)
+#define stat_search()
+#endif
+
 /*
  * Creates a new, inactive node.
+ * The node before it is assumed to be active, which holds for the first node and for the leftover half of a split.
  * @param curr_mem_index Current index in memory array
  * @param size Amount of space the node will contain
  */
-void create_node(short curr_mem_index, unsigned short size);
+void create_node(int curr_mem_index, unsigned int size);
+
+/*
+ * Chooses the initial and maximum size of the heap, overriding MYMALLOC_HEAP_SIZE and MYMALLOC_MAX_HEAP_SIZE.
+ * Must be called before the first call to mymalloc().
+ * @param initial_size Size of the heap when it is set up, in bytes
+ * @param max_size Size the heap may grow to, in bytes. Pass initial_size to keep the heap from growing.
+ * @return True if the sizes were accepted, false if they are invalid or the heap has already been set up
+ */
+bool mymalloc_init(size_t initial_size, size_t max_size);
+
+/*
+ * Chooses the placement policy, overriding MYMALLOC_POLICY.
+ * Must be called before the first call to mymalloc(), since best fit keeps its bins in a different order.
+ * @param new_policy Placement policy to use
+ * @return True if the policy was accepted, false if it is invalid or the heap has already been set up
+ */
+bool mymalloc_set_policy(placement_policy new_policy);
+
+/*
+ * Turns deferred coalescing on or off for every heap, overriding MYMALLOC_DEFER_COALESCE. Turning it off merges the quick lists of every heap into it.
+ * @param enabled True to put freed nodes in the quick lists, false to coalesce them as soon as they are freed
+ */
+void mymalloc_set_deferred_coalescing(bool enabled);
+
+/*
+ * Gives the memory of inactive nodes back to the operating system now, instead of waiting for MYMALLOC_TRIM_THRESHOLD bytes to be freed.
+ * Nodes in the quick lists are merged into the heap first.
+ * @return Bytes given back
+ */
+size_t mymalloc_trim();
+
+/*
+ * Looks up the name of a placement policy, for reports.
+ * @param policy_id Placement policy
+ * @return Name of the policy
+ */
+const char *get_policy_name(placement_policy policy_id);
+
+/*
+ * Rounds a size up to a whole number of pages.
+ * @param size Size in bytes
+ * @return Smallest multiple of the page size that is at least size
+ */
+size_t round_to_pages(size_t size);
+
+/*
+ * Determines how many bytes of a reservation a heap's block map takes. Its slack map, right after it, takes as many.
+ * @param reserve_size Bytes reserved for the heap
+ * @return Size of the block map, a whole number of pages
+ */
+size_t get_map_size(size_t reserve_size);
 
 /*
- * Sets up memory if mymalloc() has not been called previously.
- * Creates a single, inactive node encompassing all of memory.
+ * Lays out an empty heap in curr_heap: empty bins and quick lists, and a single, inactive node encompassing its usable bytes.
+ * @param *block Start of the heap, whose first initial_size bytes are usable and zero
+ * @param initial_size Usable bytes, a whole number of pages
+ * @param max_size Bytes reserved for the heap, a whole number of pages
+ * @param *block_map Zeroed block map covering max_size bytes, followed by a zeroed slack map of the same size
+ */
+void init_heap(char *block, size_t initial_size, size_t max_size, uint64_t *block_map);
+
+/*
+ * Sets up the default heap if mymalloc() has not been called previously.
+ * Reserves the maximum heap size and creates a single, inactive node encompassing the initial heap size.
  * If mymalloc() has been called in the past, nothing will be done.
+ * Every other heap is made after the default heap is set up, so curr_heap is always the default heap here.
  */
 void initialize_malloc();
 
+/*
+ * Makes another region of the reservation usable and adds it to the end of the heap as an inactive node.
+ * The new node is merged with the last node of the old heap if that node is inactive.
+ * The region is at least MYMALLOC_REGION_SIZE, and at least large enough for the request, unless that would pass the maximum heap size.
+ * @param request_size Amount of space that could not be found in the current heap
+ * @return True if the heap grew, false if it is already at its maximum size
+ */
+bool grow_heap(unsigned int request_size);
+
 /*
  * Determines whether or not the space requested by the user is a valid request.
  * The user can request a minimum of 1 byte.
  * The maximal request is determined by subtracting the size of one metadata node from the size of the memory array.
+ * Requests that round up to at least MYMALLOC_HUGE_THRESHOLD bytes from the default heap get a mapping of their own instead, so they are only limited by PTRDIFF_MAX.
+ * Both limits apply to the request once round_request() has rounded it, as that is the size the block is taken with.
  * @param request_size Amount of bytes requested by the user
  * @return True if the request is valid, and false otherwise
  */
 bool validate_request(size_t request_size, int line, char* filename);
 
+/*
+ * Rounds a valid request up to the size of the slot or node that will hold it.
+ * In debug builds the block also holds the request's guard.
+ * @param request_size Amount of bytes requested by the user
+ * @return Size of the block to take
+ */
+size_t round_request(size_t request_size);
+
+#ifdef MYMALLOC_DEBUG
+/*
+ * Writes a block's guard: canary bytes from the end of the request up to the guard record at the end of the block.
+ * Writing the guard also means mycalloc() can no longer assume the block is untouched.
+ * @param *ptr Block that is being handed out
+ * @param usable_size Usable size of the block, at least request_size + GUARD_SIZE
+ * @param request_size Bytes the user asked for
+ */
+void set_guard(void *ptr, size_t usable_size, size_t request_size, int line, char* filename);
+
+/*
+ * Checks that nothing was written past the end of a block, and reports the call that allocated it if something was.
+ * The guard is written again after a report, so an overrun is only reported once.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer other than NULL
+ * @return True if the guard is intact or ptr is not a block that is handed out, false if the block was written past its end
+ */
+bool check_guard(void *ptr, int line, char* filename);
+#endif
+
+/*
+ * Determines which bin an inactive node of a given size belongs to.
+ * @param size Size of the node
+ * @return Index of the bin
+ */
+int get_bin(unsigned int size);
+
+/*
+ * Determines the first bin whose nodes are all large enough for a request.
+ * The request is rounded up to the start of the next bin, so any node found there fits without comparing sizes.
+ * @param request_size Amount of space requested
+ * @return Index of the bin, or NUM_BINS if no bin is guaranteed to fit
+ */
+int get_search_bin(unsigned int request_size);
+
+/*
+ * Returns the free links stored in the data section of an inactive node, or in its header in aligned layout mode.
+ * @param curr_mem_index Index of the inactive node
+ * @return Pointer to the node's free links
+ */
+free_links_t *get_links(int curr_mem_index);
+
+/*
+ * Writes the boundary tag of an inactive node.
+ * @param curr_mem_index Index of the inactive node
+ */
+void set_footer(int curr_mem_index);
+
+/*
+ * Adds an inactive node to the front of the bin for its size, and marks the bin as non-empty.
+ * Under best fit, the node is instead inserted before the first node of the bin that is at least as large.
+ * Also writes the node's boundary tag, since every inactive node is in a bin.
+ * @param curr_mem_index Index of the inactive node
+ */
+void insert_free_node(int curr_mem_index);
+
+/*
+ * Unlinks an inactive node from its bin, and marks the bin as empty if it was the last node.
+ * Must be called before the node is activated, resized or absorbed by another node.
+ * @param curr_mem_index Index of the inactive node
+ */
+void remove_free_node(int curr_mem_index);
+
+/*
+ * Finds an inactive node that can hold the requested amount of space, as chosen by the placement policy.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_free_node(unsigned int request_size);
+
+/*
+ * Finds the first non-empty bin at or after a given bin, using the bitmaps.
+ * @param bin Index of the bin to start from
+ * @return Index of the bin, or NUM_BINS if every bin from there on is empty
+ */
+int find_next_bin(int bin);
+
+/*
+ * Segregated fit: finds the first node of the first non-empty bin at or after get_search_bin(), which always fits.
+ * Only if there is no such bin is the request's own bin searched, since it may still hold a node that is large enough.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_segregated_fit(unsigned int request_size);
+
+/*
+ * First fit: walks the heap from its start, and finds the first inactive node that fits.
+ * @param start_index Index of the node to start walking from
+ * @param end_index Index to stop walking at, or -1 to walk to the end of the heap
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_first_fit(int start_index, int end_index, unsigned int request_size);
+
+/*
+ * Next fit: walks the heap from the node the last search ended at, wrapping around to the start of the heap.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_next_fit(unsigned int request_size);
+
+/*
+ * Best fit: finds the smallest inactive node that fits.
+ * Bins are sorted by size, so the first node that fits in the request's own bin is the best one in it,
+ * and otherwise the first node of the next non-empty bin is.
+ * @param request_size Amount of space requested
+ * @return Index of a suitable inactive node, or -1 if there is none
+ */
+int find_best_fit(unsigned int request_size);
+
 /*
  * Calculates and returns the index of the next metadata node.
  * @param curr_mem_index Index in the memory array from which to begin counting
  * @return Index of the next metadata node
  */
-short get_next_index(short curr_mem_index);
+int get_next_index(int curr_mem_index);
 	
+/*
+ * Calculates the index of the previous metadata node using its boundary tag.
+ * Only inactive nodes carry a boundary tag, so this only finds the previous node if it can be merged with.
+ * @param curr_mem_index Index of the current node
+ * @return Index of the previous node if it is inactive, and -1 otherwise
+ */
+int get_prev_index(int curr_mem_index);
+
+/*
+ * Activates or deactivates a node, keeping the prev_active flag of the node after it in sync.
+ * @param curr_mem_index Index of the node
+ * @param active Whether the node should be active
+ */
+void set_active(int curr_mem_index, bool active);
+
 /*
  * Compares the current inactive node with the amount of requested space and determines an action.
  * @param curr_mem_index Index of the current node
  * @param request_size Amount of space requested
  * @return The first action that should be taken on the current node
  */
-action_type compare(short curr_mem_index, short request_size);
+action_type compare(int curr_mem_index, unsigned int request_size);
 
 /*
  * Splits a large node into two.
  * The first node is created with a specified size.
- * The second node is created out of the remaining space from the original node.
+ * The second node is created out of the remaining space from the original node, and is placed in its bin.
  * @param curr_mem_index Index of the large node that will be split
  * @param request_size Desired size of first node
  */
-void split_node(short curr_mem_index, short request_size);
+void split_node(int curr_mem_index, unsigned int request_size);
+
+/*
+ * Gives the end of an active node back to the heap as an inactive node, if the node is large enough to split.
+ * The new node is merged with the node after it if that node is inactive.
+ * @param curr_mem_index Index of the active node
+ * @param request_size Size the node should keep, rounded like mymalloc() rounds requests
+ */
+void trim_node(int curr_mem_index, unsigned int request_size);
+
+/*
+ * Counts the bytes of an active node beyond the request it was handed out for, and marks where the request ends in the slack map,
+ * so remove_slack() can take them off the count again once the node is freed or resized.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of the node
+ * @param request_size Size the node was handed out for, rounded like mymalloc() rounds requests
+ */
+void add_slack(int curr_mem_index, unsigned int request_size);
+
+/*
+ * Takes the slack of an active node off the count and clears its mark, if add_slack() counted any.
+ * Filled nodes never keep more slack than a header and the smallest payload, so only that far back from the end of the node is searched.
+ * Buddy blocks may keep up to half their size, and are searched whole.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of the node
+ */
+void remove_slack(int curr_mem_index);
 
 /*
  * Returns a void pointer to the beginning of the user data associated with a metadata node.
  * @param curr_mem_index Index of the metadata node
  * @return Void pointer to user data
  */
-void *get_data_ptr (short curr_mem_index);
+void *get_data_ptr (int curr_mem_index);
+
+/*
+ * Moves untouched_index past a node that is being handed out, since the user may write anywhere in it.
+ * @param curr_mem_index Index of the node
+ * @return True if the node's data started at or past untouched_index, so it only holds zeros and the node's old free links and boundary tag
+ */
+bool claim_untouched(int curr_mem_index);
+
+/*
+ * Takes a node of the requested size from the heap, growing the heap if no node fits.
+ * In buddy system mode the node is a buddy block instead, see buddy.h.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Amount of space requested, already rounded by mymalloc()
+ * @return Pointer to the node's data, or NULL if the heap is out of memory
+ */
+void *allocate_from_heap(unsigned int request_size);
+
+/*
+ * Returns an active node to the heap, merging it with inactive neighbours.
+ * In buddy system mode the node is a buddy block, and is merged with its buddy instead.
+ * Once MYMALLOC_TRIM_THRESHOLD bytes have been returned since the last trim, the heap is trimmed.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of a validated, active node
+ */
+void release_to_heap(int curr_mem_index);
+
+/*
+ * Gives the whole pages inside an inactive node's data section back to the operating system. They read as zero the next time they are touched.
+ * The free links at the start of the data section and the boundary tag at its end stay where they are.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of an inactive node
+ * @return Bytes given back
+ */
+size_t release_node_pages(int curr_mem_index);
+
+/*
+ * Gives the whole pages inside every inactive node back to the operating system, so the heap's resident memory follows what is handed out.
+ * Nodes smaller than a page are skipped, since they cannot hold a whole page. In buddy system mode every block is looked at instead.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @return Bytes given back. Pages given back by an earlier trim and not touched since are counted again.
+ */
+size_t trim_heap();
+
+/*
+ * Determines which quick list holds nodes of a given size.
+ * @param size Node size
+ * @return Index of the list, or -1 if nodes of this size are coalesced as soon as they are freed
+ */
+int get_quick_bin(unsigned int size);
+
+/*
+ * Frees a node. With deferred coalescing on, the node stays active and goes on the quick list for its size instead of being merged with its neighbours.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param curr_mem_index Index of a validated, active node
+ */
+void free_node(int curr_mem_index);
+
+/*
+ * Takes a node off the quick list for a size.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Node size wanted, already rounded by mymalloc()
+ * @return Index of an active node of exactly that size, or -1 if the list is empty
+ */
+int take_quick_node(unsigned int request_size);
+
+/*
+ * Returns every node in the quick lists to the heap, merging each with its inactive neighbours, including nodes returned before it.
+ * In thread-safe mode the caller must hold the heap lock.
+ */
+void merge_quick_lists();
+
+/*
+ * Takes a block for a rounded request, from a slab if the request is tiny, from a mapping of its own if it is huge, and from the heap otherwise.
+ * Tiny requests fall back to the heap when the slab area is full. Heaps other than the default heap always take a node.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param request_size Amount of space requested, already rounded by mymalloc()
+ * @return Pointer to the block, or NULL if there is no memory left
+ */
+void *allocate_block(size_t request_size);
+
+/*
+ * Returns a validated block to the slab, node or mapping it came from.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer to a block that is handed out
+ */
+void release_block(void *ptr);
 
 /*
  * Allocates space of requested size in "dynamic" memory.
@@ -102,28 +825,66 @@ void *get_data_ptr (short curr_mem_index);
 void *mymalloc(size_t request_size, int line, char* filename);
 
 /*
- * Determines whether or not a pointer lies within the memory array
+ * Finds a pointer's bit in the block map.
+ * @param *ptr Any pointer
+ * @param *word Set to the index of the word holding the bit
+ * @return Mask of the bit within its word, or 0 if ptr cannot be the data of a node, because it lies outside the heap reservation or is misaligned
+ */
+uint64_t get_block_bit(void *ptr, size_t *word);
+
+/*
+ * Records that a block is handed out. Slots and huge blocks are tracked by their slab and by huge.c, and are ignored.
+ * @param *ptr Block that is being handed out
+ */
+void mark_handed_out(void *ptr);
+
+/*
+ * Records that a block is no longer handed out, if it was.
+ * @param *ptr Any pointer
+ * @return True if ptr was a block in the heap that is handed out, false if it was freed already or never handed out
+ */
+bool unmark_handed_out(void *ptr);
+
+/*
+ * Determines whether or not a pointer is a block in the heap that is handed out, without walking the heap or trusting the memory in front of ptr.
+ * @param *ptr Any pointer
+ * @return True if ptr is a block in the heap that is handed out, false otherwise
+ */
+bool is_handed_out(void *ptr);
+
+/*
+ * Determines whether or not a pointer lies within the usable part of the memory array, or within the slab area
  * @param *ptr Prospective pointer
- * @return True if pointer is within the array, false otherwise
+ * @return True if pointer is within the array or the slab area, false otherwise
  */
 bool validate_ptr(void *ptr);
 
+/*
+ * Determines whether or not an index holds a real metadata node, by checking that the header is consistent with its surroundings.
+ * The node must be aligned and fit in the memory array, and the nodes on either side must agree with its flags.
+ * In buddy system mode the node is a buddy block, and must be a power of two in size and aligned to its size instead.
+ * @param curr_mem_index Prospective index of a metadata node
+ * @return True if the header looks like a node created by mymalloc(), false otherwise
+ */
+bool validate_node(int curr_mem_index);
+
 /*
  * Merges two nodes.
  * The first node absorbs the second node, creating one large node.
  * @param first_index Index of the first node
  * @param second_index Index of the second node
  */
-void merge_two_nodes(short first_index, short second_index);
+void merge_two_nodes(int first_index, int second_index);
 
 /*
  * Attempts to combine the current node with the node before and after it.
  * Nodes can only be combined if they are both inactive.
+ * Absorbed neighbours are removed from their bins, and the resulting node is placed in the bin for its new size.
  * @param prev_mem_index Index of the previous node
  * @param curr_mem_index Index of the current node
  * @param next_mem_index Index of the next node
  */
-void combine_nodes(short prev_mem_index, short curr_mem_index, short next_mem_index);
+void combine_nodes(int prev_mem_index, int curr_mem_index, int next_mem_index);
 
 /*
  * Frees a block of dynamically allocated memory for future use.
@@ -132,11 +893,307 @@ void combine_nodes(short prev_mem_index, short curr_mem_index, short next_mem_in
  */
 void myfree(void *ptr, int LINE, char *FILE);
 
+/*
+ * Frees a huge block, unmapping it so its memory goes straight back to the operating system.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer that lies outside the heap and the slab area
+ * @return True if ptr was a huge block that is handed out and is now freed, false if the caller must report it
+ */
+bool free_huge_block(void *ptr, int LINE, char *FILE);
+
+/*
+ * Looks up how many bytes of a block the user can use, which may be more than they asked for.
+ * @param *ptr Pointer returned by mymalloc()
+ * @return Usable size of the block, or 0 if ptr is not a block that is handed out
+ */
+size_t mymalloc_usable_size(void *ptr);
+
+/*
+ * Looks up the usable size of a block.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer other than NULL
+ * @return Usable size of the block, or 0 if ptr is not a block that is handed out
+ */
+size_t get_usable_size(void *ptr);
+
+/*
+ * Allocates zeroed space for an array.
+ * Nodes that start past untouched_index are still zero from mmap(), so only their old free links and boundary tag are cleared.
+ * @param num_items Number of items in the array
+ * @param item_size Size of one item in bytes
+ * @return Pointer to the zeroed block, or NULL if the request is invalid or there is no memory left
+ */
+void *mycalloc(size_t num_items, size_t item_size, int line, char* filename);
+
+/*
+ * Resizes a handed out block without copying it, if it can.
+ * A node shrinks by giving its end back to the heap, and grows by absorbing the inactive node after it, growing the heap first if that node is the last one.
+ * Slots and buddy blocks only keep their place if they are already large enough.
+ * Huge blocks are remapped, which may move them, but moves their pages instead of copying their data. A block never becomes huge, or stops being huge, in place.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param *ptr Pointer to a block that is handed out
+ * @param request_size New size in bytes, at least 1
+ * @return Pointer to the block, which only differs from ptr for huge blocks, or NULL if it must be copied to a new block
+ */
+void *resize_block(void *ptr, size_t request_size);
+
+/*
+ * Resizes a block, keeping its contents up to the smaller of the old and new sizes.
+ * The block is resized in place when resize_block() can, and moved to a new block otherwise.
+ * @param *ptr Pointer returned by mymalloc(), or NULL to allocate a new block
+ * @param request_size New size in bytes. A size of 0 frees the block.
+ * @return Pointer to the resized block, or NULL if it was freed or could not be resized. A block that could not be resized is left as it was.
+ */
+void *myrealloc(void *ptr, size_t request_size, int line, char* filename);
+
+/*
+ * Allocates space whose address is a multiple of an alignment.
+ * A node with room for the alignment is taken from the heap, and the space in front of the aligned address and after the request is given back.
+ * Huge blocks start on a page, so they are aligned to MAX_ALIGNMENT already, even in the buddy system.
+ * Not supported by the buddy system, whose blocks always start 4 bytes past a power of two.
+ * @param alignment Required alignment, a power of two of at most MAX_ALIGNMENT
+ * @param request_size Amount of memory requested by user
+ * @return Pointer to the aligned block, or NULL if the request is invalid or there is no memory left
+ */
+void *myaligned_alloc(size_t alignment, size_t request_size, int line, char* filename);
+
+/*
+ * Carves the blocks of a batch out of a single node, laying out every header in one pass instead of searching the heap once per block.
+ * The last block keeps any space the node had beyond the batch.
+ * In thread-safe mode the caller must hold the heap lock.
+ * @param num_blocks Number of blocks, at least 1
+ * @param request_size Size of each block, already rounded by round_request() and too large for a slab
+ * @param **out Set to the blocks
+ * @return True if one node held the whole batch, false if nothing was allocated
+ */
+bool carve_batch(size_t num_blocks, unsigned int request_size, void **out);
+
+/*
+ * Allocates a batch of blocks of the same size, validating the request and taking the lock once.
+ * Blocks too large for a slab are carved out of one node when one is large enough, and are taken one by one otherwise. Huge blocks are always taken one by one.
+ * @param num_blocks Number of blocks to allocate
+ * @param request_size Size of each block in bytes
+ * @param **out Room for num_blocks pointers, set to the blocks
+ * @return True if every block was allocated. Otherwise none are, and out is filled with NULL.
+ */
+bool mymalloc_batch(size_t num_blocks, size_t request_size, void **out, int line, char* filename);
+
+/*
+ * Frees a batch of blocks, taking the lock once.
+ * The pointers are sorted by address, so each run of neighbouring nodes is merged into one node as it is found,
+ * and is filed in a bin once instead of once per block.
+ * Every pointer is checked like myfree() checks it, and invalid ones are reported and skipped.
+ * @param **ptrs Pointers to free. The array is sorted in place.
+ * @param num_ptrs Number of pointers
+ */
+void myfree_batch(void **ptrs, size_t num_ptrs, int LINE, char *FILE);
+
+/*
+ * Creates a heap of its own, for a subsystem whose blocks should sit together and be freed at once, see heap_t.
+ * Not supported by the buddy system, which keeps a single set of free lists.
+ * @param max_size Bytes the heap may grow to. It starts with MYMALLOC_REGION_SIZE of them usable, or all of them if that is fewer.
+ * @return Handle of the heap, or NULL if the size is invalid or no address space is left
+ */
+heap_t *myheap_create(size_t max_size, int line, char *filename);
+
+/*
+ * Allocates space from a heap made by myheap_create(), like mymalloc() does from the default heap.
+ * @param *heap Heap to allocate from
+ * @param request_size Amount of memory requested by user
+ * @return Pointer to the block, or NULL if the request is invalid or the heap is out of memory
+ */
+void *myheap_alloc(heap_t *heap, size_t request_size, int line, char *filename);
+
+/*
+ * Frees a block of a heap made by myheap_create(), like myfree() does for the default heap.
+ * Pointers that do not lie within the heap are reported, even if another heap handed them out.
+ * @param *heap Heap the block came from
+ * @param *ptr Pointer returned by myheap_alloc() for the same heap
+ */
+void myheap_free(heap_t *heap, void *ptr, int LINE, char *FILE);
+
+/*
+ * Destroys a heap made by myheap_create(), freeing every block still handed out from it at once by unmapping the whole reservation.
+ * No other thread may be using the heap, and its blocks must not be used afterwards.
+ * @param *heap Heap to destroy
+ */
+void myheap_destroy(heap_t *heap, int line, char *filename);
+
+#ifdef MYMALLOC_THREAD_SAFE
+/*
+ * Determines which thread cache bin holds nodes of a given size.
+ * @param size Node size, already rounded by mymalloc()
+ * @return Index of the bin, or -1 if nodes of this size are not cached
+ */
+int get_cache_bin(size_t size);
+
+/*
+ * Takes a node from the shared heap. If the heap is out of memory, the calling thread's cached blocks are given back first and the request is retried.
+ * The caller must hold the heap lock.
+ * @param request_size Amount of space requested, already rounded by mymalloc()
+ * @return Pointer to the node's data, or NULL if the heap is out of memory
+ */
+void *allocate_or_reclaim(size_t request_size);
+
+/*
+ * Fills an empty bin of the calling thread's cache with up to TCACHE_BATCH nodes from the shared heap, taking the lock once.
+ * A node that comes back larger than asked, because the rest of its free node was too small to split off, is filed in the bin of its own size,
+ * or given back if that bin is full or it is too large to cache, and the refill stops there. The bin may be left empty.
+ * @param size Node size the bin holds
+ * @param cache_bin Index of the bin
+ */
+void refill_cache(unsigned int size, int cache_bin);
+
+/*
+ * Returns blocks from a bin of a thread cache to the shared heap.
+ * The caller must hold the heap lock.
+ * @param *cache Thread cache to take the blocks from
+ * @param cache_bin Index of the bin
+ * @param count Most blocks to return
+ */
+void release_cache_bin(thread_cache_t *cache, int cache_bin, unsigned int count);
+
+/*
+ * Returns blocks from a bin of a thread cache to the shared heap, taking the lock once.
+ * @param *cache Thread cache to take the blocks from
+ * @param cache_bin Index of the bin
+ * @param count Most blocks to return
+ */
+void flush_cache_bin(thread_cache_t *cache, int cache_bin, unsigned int count);
+
+/*
+ * Returns every block in a thread cache to the shared heap. Runs automatically when a thread exits.
+ * @param *cache Thread cache to empty
+ */
+void flush_cache(void *cache);
+
+/*
+ * Pushes a freed node onto the remote free list with a CAS, without taking the heap lock.
+ * @param *entry Data of the node, which holds its link until the node is taken off the list
+ */
+void push_remote_free(cache_entry_t *entry);
+
+/*
+ * Takes every node on the remote free list at once and frees it into the heap.
+ * The caller must hold the heap lock.
+ */
+void drain_remote_frees();
+
+/*
+ * Sets up the calling thread's cache the first time the thread allocates: makes sure it is flushed when the thread exits,
+ * and takes a free remote free list, so the thread can own blocks.
+ */
+void register_cache();
+
+/*
+ * Looks up the thread that allocated a block of the default heap.
+ * @param *ptr Block within the heap or the slab area
+ * @return Index of the owner's remote free list, or 0 if the block has no owner
+ */
+int get_owner(void *ptr);
+
+/*
+ * Records the calling thread as the owner of a block it is handing out from the default heap.
+ * @param *ptr Block within the heap or the slab area
+ */
+void set_owner(void *ptr);
+
+/*
+ * Pushes a block freed on another thread onto its owner's remote free list with a CAS, without taking any lock.
+ * @param *entry Block, which holds its link until the owner takes it off the list
+ * @param owner Index of the owner's list
+ * @return True if the block was pushed, false if the owner has exited and closed its list
+ */
+bool push_owned_free(cache_entry_t *entry, int owner);
+
+/*
+ * Takes every block other threads pushed onto the calling thread's remote free list at once.
+ * Blocks the cache has room for are filed in it. The others are given back to the shared heap, taking the lock once.
+ */
+void drain_owned_frees();
+
+/*
+ * Closes a thread's remote free list when the thread exits, and gives every block on it back to the shared heap.
+ * Later frees of the thread's blocks go through the shared heap, until another thread takes the list.
+ * @param *cache Cache of the exiting thread
+ */
+void close_owned_frees(thread_cache_t *cache);
+
+/*
+ * Frees a block allocated on another thread back to that thread, without taking the heap lock.
+ * Only the block map, or the block's slot, is checked, like free_to_cache() checks it.
+ * @param *ptr Pointer to free, already known to lie within the heap or the slab area
+ * @param owner Index of the owner's remote free list
+ * @return True if the block was freed or rejected with an error, false if it must be freed through the shared heap
+ */
+bool free_to_owner(void *ptr, int owner, int LINE, char *FILE);
+
+/*
+ * Attempts to free a block into the calling thread's cache, without taking the heap lock.
+ * Other threads may be changing the neighbouring nodes, so only the block map, or the block's slot, is checked here.
+ * @param *ptr Pointer to free, already known to lie within the heap or the slab area
+ * @return True if the block was cached or rejected with an error, false if it must be freed through the shared heap
+ */
+bool free_to_cache(void *ptr, int LINE, char *FILE);
+#endif
+
+/*
+ * Determines which size class a block is counted in.
+ * @param usable_size Usable size of the block
+ * @return Index of the size class
+ */
+int get_stats_class(size_t usable_size);
+
+#ifdef MYMALLOC_STATS
+/*
+ * Counts a block handed out to the user, and raises the peak if needed.
+ * @param usable_size Usable size of the block
+ */
+void record_alloc(size_t usable_size);
+
+/*
+ * Counts a block the user gave back.
+ * @param usable_size Usable size of the block, or 0 if it turned out not to be handed out, in which case nothing is counted
+ */
+void record_free(size_t usable_size);
+
+/*
+ * Counts one search of the heap for an inactive node, along with the nodes it looked at since the last search.
+ */
+void record_search();
+#endif
+
+/*
+ * Copies the allocator's counters, without walking the heap.
+ * @param *stats Filled in with the counters, or with zeros if statistics are compiled out
+ * @return True if statistics are enabled, false otherwise
+ */
+bool mymalloc_get_stats(mymalloc_stats_t *stats);
+
 /*
  * Prints out the nodes of our memory array.
  */
 void print_memory();
 
+/*
+ * Walks the heap and measures how its free space is laid out.
+ * @param *analysis Filled in with the results, or with zeros if the heap has not been set up
+ */
+void analyze_heap(heap_analysis_t *analysis);
+
+/*
+ * Analyzes the heap and writes the results in a machine-readable format.
+ * @param *out Stream to write to
+ * @param format FORMAT_JSON or FORMAT_CSV
+ */
+void export_heap_analysis(FILE *out, analysis_format format);
+
+/*
+ * Writes every node of the heap as CSV, one "index,size,active" line per node after a header line.
+ * @param *out Stream to write to
+ */
+void export_heap_map(FILE *out);
+
 #endif /* MYMALLOC_H_ */
 
 
@@ -0,0 +1,185 @@
+
+#include "mymalloc.h"
+#include <errno.h>
+#include <unistd.h>
+
+// this file defines the C library's allocation functions, so it needs their real names
+#undef malloc
+#undef free
+#undef calloc
+#undef realloc
+#undef aligned_alloc
+
+/*
+ * Marks a function as exported from the shared library. Everything else in the library is hidden, so a program that
+ * defines a function with the same name as one of the allocator's own cannot replace it.
+ */
+#define PRELOAD_EXPORT __attribute__((visibility("default")))
+
+/*
+ * Allocates space, like the C library's malloc().
+ * Unlike mymalloc(), a request of 0 bytes is valid and gets the smallest block.
+ * @param size Amount of memory requested
+ * @return Pointer to the block, or NULL with errno set to ENOMEM if there is no memory left
+ */
+PRELOAD_EXPORT void *malloc(size_t size)
+{
+	void *ptr = mymalloc(size > 0 ? size : 1, __LINE__, __FILE__);
+	if (ptr == NULL)
+	{
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+/*
+ * Frees a block, like the C library's free(). Freeing NULL does nothing.
+ * @param *ptr Pointer returned by one of the allocation functions in this file, or NULL
+ */
+PRELOAD_EXPORT void free(void *ptr)
+{
+	if (ptr != NULL)
+	{
+		myfree(ptr, __LINE__, __FILE__);
+	}
+}
+
+/*
+ * Allocates zeroed space for an array, like the C library's calloc().
+ * @param num_items Number of items in the array
+ * @param item_size Size of one item in bytes
+ * @return Pointer to the zeroed block, or NULL with errno set to ENOMEM if the size overflows or there is no memory left
+ */
+PRELOAD_EXPORT void *calloc(size_t num_items, size_t item_size)
+{
+	void *ptr = num_items > 0 && item_size > 0 ? mycalloc(num_items, item_size, __LINE__, __FILE__) : mycalloc(1, 1, __LINE__, __FILE__);
+	if (ptr == NULL)
+	{
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+/*
+ * Resizes a block, like the C library's realloc().
+ * @param *ptr Pointer to resize, or NULL to allocate a new block
+ * @param size New size in bytes. A size of 0 frees the block.
+ * @return Pointer to the resized block, or NULL if it was freed or could not be resized
+ */
+PRELOAD_EXPORT void *realloc(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+	{
+		return malloc(size);
+	}
+
+	void *new_ptr = myrealloc(ptr, size, __LINE__, __FILE__);
+	if (new_ptr == NULL && size > 0)
+	{
+		errno = ENOMEM;
+	}
+	return new_ptr;
+}
+
+/*
+ * Allocates space whose address is a multiple of an alignment, like the C library's aligned_alloc().
+ * @param alignment Required alignment, a power of two of at most MAX_ALIGNMENT
+ * @param size Amount of memory requested
+ * @return Pointer to the block, or NULL with errno set if the alignment is not supported or there is no memory left
+ */
+PRELOAD_EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > MAX_ALIGNMENT)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	void *ptr = myaligned_alloc(alignment, size > 0 ? size : 1, __LINE__, __FILE__);
+	if (ptr == NULL)
+	{
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+/*
+ * Allocates aligned space and stores its address, like the C library's posix_memalign().
+ * @param **ptr Set to the block if it was allocated
+ * @param alignment Required alignment, a power of two that is a multiple of sizeof(void*)
+ * @param size Amount of memory requested
+ * @return 0 on success, EINVAL if the alignment is invalid, or ENOMEM if it is larger than MAX_ALIGNMENT or there is no memory left
+ */
+PRELOAD_EXPORT int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+	{
+		return EINVAL;
+	}
+	if (alignment > MAX_ALIGNMENT)
+	{
+		return ENOMEM;
+	}
+
+	void *block = myaligned_alloc(alignment, size > 0 ? size : 1, __LINE__, __FILE__);
+	if (block == NULL)
+	{
+		return ENOMEM;
+	}
+
+	*ptr = block;
+	return 0;
+}
+
+/*
+ * Allocates aligned space, like the obsolete memalign(). Exported so blocks from it are never passed to free() by mistake.
+ * @param alignment Required alignment, a power of two of at most MAX_ALIGNMENT
+ * @param size Amount of memory requested
+ * @return Pointer to the block, or NULL with errno set if the alignment is not supported or there is no memory left
+ */
+PRELOAD_EXPORT void *memalign(size_t alignment, size_t size)
+{
+	return aligned_alloc(alignment, size);
+}
+
+/*
+ * Allocates page-aligned space, like the obsolete valloc().
+ * @param size Amount of memory requested
+ * @return Pointer to the block, or NULL with errno set to ENOMEM if there is no memory left
+ */
+PRELOAD_EXPORT void *valloc(size_t size)
+{
+	return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+/*
+ * Allocates page-aligned space rounded up to a whole number of pages, like the obsolete pvalloc().
+ * @param size Amount of memory requested
+ * @return Pointer to the block, or NULL with errno set to ENOMEM if there is no memory left
+ */
+PRELOAD_EXPORT void *pvalloc(size_t size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	return aligned_alloc(page_size, (size + page_size - 1) / page_size * page_size);
+}
+
+/*
+ * Looks up how many bytes of a block can be used, like the C library's malloc_usable_size().
+ * @param *ptr Pointer returned by one of the allocation functions in this file, or NULL
+ * @return Usable size of the block, or 0 if ptr is NULL or not a block that is handed out
+ */
+PRELOAD_EXPORT size_t malloc_usable_size(void *ptr)
+{
+	return mymalloc_usable_size(ptr);
+}
+
+/*
+ * Gives free memory back to the operating system, like the C library's malloc_trim().
+ * @param pad Bytes to keep at the end of the heap, ignored since only whole pages inside inactive nodes are given back
+ * @return 1 if any memory was given back, 0 otherwise
+ */
+PRELOAD_EXPORT int malloc_trim(size_t pad)
+{
+	(void) pad;
+	return mymalloc_trim() > 0;
+}
@@ -0,0 +1,299 @@
+
+#include "profile.h"
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef MYMALLOC_THREAD_SAFE
+#include <pthread.h>
+
+/*
+ * Protects the call sites and the samples. Frees of blocks that were not sampled never take it, see sampled_counts.
+ */
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Calls left until the calling thread takes its next sample, and the state of its random number generator.
+ */
+static __thread unsigned int calls_until_sample = 0;
+static __thread uint32_t sample_seed = 0;
+
+#define lock_profile() pthread_mutex_lock(&profile_lock)
+#define unlock_profile() pthread_mutex_unlock(&profile_lock)
+#else
+static unsigned int calls_until_sample = 0;
+static uint32_t sample_seed = 0;
+
+#define lock_profile()
+#define unlock_profile()
+#endif
+
+/*
+ * Call sites and sampled blocks, as open-addressed hash tables.
+ */
+static profile_site_t sites[PROFILE_MAX_SITES];
+static profile_sample_t samples[PROFILE_MAX_SAMPLES];
+static int num_sites = 0;
+static int num_samples = 0;
+
+/*
+ * Number of sampled blocks whose pointers hash to each entry, changed with the profile lock held and read without it,
+ * so profile_record_free() can tell a block was not sampled without taking the lock. Most entries are 0, since few blocks are sampled.
+ */
+static uint16_t sampled_counts[PROFILE_FILTER_SIZE];
+
+/*
+ * When the first sample was taken, for allocation rates, and samples dropped because a table was full.
+ */
+static uint64_t profile_start_ns = 0;
+static unsigned long dropped_samples = 0;
+
+/*
+ * Reads the monotonic clock.
+ * @return Time in nanoseconds
+ */
+static uint64_t profile_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Picks how many calls to skip before the next sample, between 1 and 2 * MYMALLOC_PROFILE_RATE - 1, so samples average one in MYMALLOC_PROFILE_RATE
+ * and do not line up with loops that allocate in a fixed pattern.
+ * @return Number of calls until the next sample
+ */
+static unsigned int next_sample_interval()
+{
+	if (sample_seed == 0)	// first use in this thread
+	{
+		sample_seed = (uint32_t) (uintptr_t) &sample_seed | 1;
+	}
+
+	sample_seed ^= sample_seed << 13;	// xorshift
+	sample_seed ^= sample_seed >> 17;
+	sample_seed ^= sample_seed << 5;
+
+	return sample_seed % (2 * MYMALLOC_PROFILE_RATE - 1) + 1;
+}
+
+/*
+ * Hashes a pointer or a call site into a table index.
+ * @param key Value to hash
+ * @param table_size Number of entries, a power of two
+ * @return Index to start probing at
+ */
+static unsigned int hash_key(uintptr_t key, unsigned int table_size)
+{
+	return (unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (table_size - 1);
+}
+
+/*
+ * Finds the entry of a call site, adding it if it is new. The caller must hold the profile lock.
+ * @param line __LINE__ of the call site
+ * @param *filename __FILE__ of the call site
+ * @return Index of the site, or -1 if the table is full
+ */
+static int find_site(int line, char *filename)
+{
+	unsigned int i = hash_key((uintptr_t) filename ^ (uintptr_t) line << 40, PROFILE_MAX_SITES);
+
+	while (sites[i].filename != NULL)
+	{
+		if (sites[i].filename == filename && sites[i].line == line)	// __FILE__ is a string literal, so compare addresses
+		{
+			return i;
+		}
+		i = (i + 1) & (PROFILE_MAX_SITES - 1);
+	}
+
+	if (num_sites >= PROFILE_MAX_SITES / 2)	// keep probes short
+	{
+		return -1;
+	}
+
+	sites[i].filename = filename;
+	sites[i].line = line;
+	num_sites++;
+	return i;
+}
+
+/*
+ * Finds the entry of a sampled block, or the empty entry where it belongs. The caller must hold the profile lock.
+ * @param *ptr The block
+ * @return Index of the entry
+ */
+static unsigned int find_sample(void *ptr)
+{
+	unsigned int i = hash_key((uintptr_t) ptr, PROFILE_MAX_SAMPLES);
+
+	while (samples[i].ptr != NULL && samples[i].ptr != ptr)
+	{
+		i = (i + 1) & (PROFILE_MAX_SAMPLES - 1);
+	}
+
+	return i;
+}
+
+/*
+ * Removes a sampled block, moving later entries of its probe run back so lookups never stop early. The caller must hold the profile lock.
+ * @param hole Index of the entry to remove
+ */
+static void remove_sample(unsigned int hole)
+{
+	unsigned int i = hole;
+
+	samples[hole].ptr = NULL;
+	num_samples--;
+
+	while (true)
+	{
+		i = (i + 1) & (PROFILE_MAX_SAMPLES - 1);
+		if (samples[i].ptr == NULL)
+		{
+			return;
+		}
+
+		unsigned int home = hash_key((uintptr_t) samples[i].ptr, PROFILE_MAX_SAMPLES);
+		if (((i - home) & (PROFILE_MAX_SAMPLES - 1)) >= ((i - hole) & (PROFILE_MAX_SAMPLES - 1)))	// entry can fill the hole
+		{
+			samples[hole] = samples[i];
+			samples[i].ptr = NULL;
+			hole = i;
+		}
+	}
+}
+
+/*
+ * Prints the default report when the program exits.
+ */
+static void report_at_exit()
+{
+	profile_report(stdout, PROFILE_REPORT_SIZE);
+}
+
+/*
+ * Counts a block handed out by mymalloc(), if this call is sampled.
+ * @param *ptr Block returned to the user
+ * @param size Bytes asked for
+ * @param line __LINE__ of the call
+ * @param *filename __FILE__ of the call
+ */
+void profile_record_malloc(void *ptr, size_t size, int line, char *filename)
+{
+	if (calls_until_sample > 1)	// not sampled, the common case
+	{
+		calls_until_sample--;
+		return;
+	}
+	calls_until_sample = next_sample_interval();
+
+	uint64_t now = profile_now();
+
+	lock_profile();
+
+	if (profile_start_ns == 0)	// first sample
+	{
+		profile_start_ns = now;
+		atexit(report_at_exit);
+	}
+
+	int site = find_site(line, filename);
+	if (site < 0 || num_samples >= PROFILE_MAX_SAMPLES / 2)
+	{
+		dropped_samples++;
+		unlock_profile();
+		return;
+	}
+
+	unsigned int i = find_sample(ptr);
+	if (samples[i].ptr == NULL)	// a block is only counted once, even if it somehow was never freed
+	{
+		__atomic_add_fetch(&sampled_counts[hash_key((uintptr_t) ptr, PROFILE_FILTER_SIZE)], 1, __ATOMIC_RELAXED);
+		num_samples++;
+	}
+	samples[i].ptr = ptr;
+	samples[i].site = site;
+	samples[i].size = size;
+	samples[i].alloc_ns = now;
+
+	sites[site].allocs++;
+	sites[site].bytes += size;
+	sites[site].live_bytes += size;
+
+	unlock_profile();
+}
+
+/*
+ * Counts a block freed by myfree(), if it was sampled.
+ * @param *ptr Block the user freed
+ */
+void profile_record_free(void *ptr)
+{
+	unsigned int filter_index = hash_key((uintptr_t) ptr, PROFILE_FILTER_SIZE);
+	if (__atomic_load_n(&sampled_counts[filter_index], __ATOMIC_RELAXED) == 0)	// not sampled, the common case
+	{
+		return;
+	}
+
+	lock_profile();
+
+	unsigned int i = find_sample(ptr);
+	if (samples[i].ptr != NULL)	// block was sampled
+	{
+		profile_site_t *site = &sites[samples[i].site];
+
+		site->frees++;
+		site->live_bytes -= samples[i].size;
+		site->lifetime_ns += profile_now() - samples[i].alloc_ns;
+		remove_sample(i);
+		__atomic_sub_fetch(&sampled_counts[filter_index], 1, __ATOMIC_RELAXED);
+	}
+
+	unlock_profile();
+}
+
+/*
+ * Prints the call sites with the most live bytes, with estimates scaled up by the sampling rate.
+ * @param *out Stream to write to
+ * @param top_n Most call sites to print
+ */
+void profile_report(FILE *out, int top_n)
+{
+	bool printed[PROFILE_MAX_SITES] = {false};
+	int i, n;
+
+	lock_profile();
+
+	double seconds = profile_start_ns > 0 ? (profile_now() - profile_start_ns) * 1e-9 : 0;
+	fprintf(out, "Allocation profile, 1 in %d calls sampled, %lu samples dropped:\n", MYMALLOC_PROFILE_RATE, dropped_samples);
+	fprintf(out, "%-32s %12s %14s %14s %14s %18s\n", "Call site", "Allocs", "Bytes", "Live bytes", "Allocs/sec", "Avg lifetime (us)");
+
+	for (n = 0; n < top_n; n++)	// selection sort, top_n is small
+	{
+		int best = -1;
+		for (i = 0; i < PROFILE_MAX_SITES; i++)
+		{
+			if (sites[i].filename != NULL && !printed[i]
+					&& (best < 0 || sites[i].live_bytes > sites[best].live_bytes || (sites[i].live_bytes == sites[best].live_bytes && sites[i].bytes > sites[best].bytes)))
+			{
+				best = i;
+			}
+		}
+		if (best < 0)	// fewer sites than top_n
+		{
+			break;
+		}
+		printed[best] = true;
+
+		profile_site_t *site = &sites[best];
+		char name[256];
+		snprintf(name, sizeof(name), "%s:%d", site->filename, site->line);
+
+		fprintf(out, "%-32s %12lu %14llu %14llu %14.0f %18.2f\n", name, site->allocs * MYMALLOC_PROFILE_RATE,
+				(unsigned long long) site->bytes * MYMALLOC_PROFILE_RATE, (unsigned long long) site->live_bytes * MYMALLOC_PROFILE_RATE,
+				seconds > 0 ? site->allocs * MYMALLOC_PROFILE_RATE / seconds : 0, site->frees > 0 ? site->lifetime_ns * 1e-3 / site->frees : 0);
+	}
+
+	unlock_profile();
+}
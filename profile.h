@@ -0,0 +1,90 @@
+/*
+ * profile.h
+ *
+ *  Sampling allocation profiler, keyed on the call site passed by the malloc() and free() macros.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Profiling mode, enabled by building with -DMYMALLOC_PROFILE.
+ * About one in MYMALLOC_PROFILE_RATE mymalloc() calls is sampled. A sampled block remembers its call site and when it was handed out,
+ * so freeing it adds to its call site's lifetime and live bytes. Reports scale the sampled counts back up by the rate.
+ * A report of the PROFILE_REPORT_SIZE call sites with the most live bytes is printed when the program exits,
+ * and profile_report() prints one at any time.
+ */
+
+/*
+ * Average number of mymalloc() calls per sample. 1 samples every call.
+ */
+#ifndef MYMALLOC_PROFILE_RATE
+#define MYMALLOC_PROFILE_RATE 8
+#endif
+
+/*
+ * Most call sites, and most sampled blocks that are handed out at the same time. Samples past either limit are dropped.
+ */
+#define PROFILE_MAX_SITES 4096
+#define PROFILE_MAX_SAMPLES 65536
+
+/*
+ * Entries in the filter that lets frees of blocks that were not sampled skip the profile lock, a power of two.
+ */
+#define PROFILE_FILTER_SIZE 16384
+
+/*
+ * Number of call sites in the report printed at exit.
+ */
+#define PROFILE_REPORT_SIZE 10
+
+/*
+ * Totals for one call site, from sampled calls only.
+ */
+typedef struct profile_site_t {
+	char *filename;	// __FILE__ of the call site, or NULL for an unused entry
+	int line;	// __LINE__ of the call site
+	unsigned long allocs;	// Sampled blocks handed out
+	unsigned long frees;	// Sampled blocks freed
+	uint64_t bytes;	// Bytes asked for by sampled calls
+	uint64_t live_bytes;	// Bytes asked for by sampled blocks that are not freed yet
+	uint64_t lifetime_ns;	// Total time sampled blocks were handed out for, counting freed blocks only
+} profile_site_t;
+
+/*
+ * A sampled block that is handed out.
+ */
+typedef struct profile_sample_t {
+	void *ptr;	// The block, or NULL for an unused entry
+	int site;	// Index of its call site
+	unsigned int size;	// Bytes asked for
+	uint64_t alloc_ns;	// When it was handed out
+} profile_sample_t;
+
+/*
+ * Counts a block handed out by mymalloc(), if this call is sampled.
+ * @param *ptr Block returned to the user
+ * @param size Bytes asked for
+ * @param line __LINE__ of the call
+ * @param *filename __FILE__ of the call
+ */
+void profile_record_malloc(void *ptr, size_t size, int line, char *filename);
+
+/*
+ * Counts a block freed by myfree(), if it was sampled.
+ * @param *ptr Block the user freed
+ */
+void profile_record_free(void *ptr);
+
+/*
+ * Prints the call sites with the most live bytes, with estimates scaled up by the sampling rate.
+ * @param *out Stream to write to
+ * @param top_n Most call sites to print
+ */
+void profile_report(FILE *out, int top_n);
+
+#endif /* PROFILE_H_ */
@@ -0,0 +1,250 @@
+
+#include "mymalloc.h"
+#include "trace.h"
+#include <string.h>
+#include <time.h>
+
+// the driver replays against either allocator by name, so it needs the system allocator as well
+#undef malloc
+#undef free
+#undef calloc
+#undef realloc
+#undef aligned_alloc
+
+/*
+ * A call to replay. Frees name the malloc() whose block they free, so replaying needs no lookups.
+ */
+typedef struct replay_op_t {
+	bool is_free;
+	size_t size;	// Bytes to allocate, for mallocs
+	long block;	// Index of the malloc() in the trace, counting only mallocs
+} replay_op_t;
+
+/*
+ * A block that was handed out when the trace was recorded, for matching frees to mallocs while loading.
+ */
+typedef struct live_block_t {
+	uint64_t offset;	// Offset of the block, or TRACE_NULL_OFFSET for an unused entry
+	long block;	// Index of the malloc() that returned it, or -1 once it is freed
+} live_block_t;
+
+void *call_mymalloc(size_t size)
+{
+	return mymalloc(size, __LINE__, __FILE__);
+}
+
+void call_myfree(void *ptr)
+{
+	myfree(ptr, __LINE__, __FILE__);
+}
+
+/*
+ * Finds the entry for an offset in an open-addressed table, or the empty entry where it belongs.
+ * @param *table Table with a power of two entries, never full
+ * @param table_size Number of entries
+ * @param offset Offset to look for
+ * @return The entry
+ */
+live_block_t *find_live_block(live_block_t *table, size_t table_size, uint64_t offset)
+{
+	size_t i = (offset * 0x9E3779B97F4A7C15ULL) >> 20 & (table_size - 1);	// spread aligned offsets across the table
+
+	while (table[i].offset != TRACE_NULL_OFFSET && table[i].offset != offset)
+	{
+		i = (i + 1) & (table_size - 1);
+	}
+
+	return &table[i];
+}
+
+/*
+ * Reads a trace file into a list of calls, matching every free to the malloc() whose block it frees.
+ * Frees of blocks that are not handed out at that point in the trace are dropped.
+ * @param *path Path of the trace file
+ * @param *num_ops Set to the number of calls
+ * @param *num_blocks Set to the number of mallocs
+ * @return The calls, or NULL if the file could not be read
+ */
+replay_op_t *load_trace(const char *path, long *num_ops, long *num_blocks)
+{
+	FILE *trace_file = fopen(path, "rb");
+	char magic[TRACE_MAGIC_SIZE];
+
+	if (trace_file == NULL || fread(magic, 1, TRACE_MAGIC_SIZE, trace_file) != TRACE_MAGIC_SIZE || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+	{
+		printf("%s is not a trace file\n", path);
+		if (trace_file != NULL)
+		{
+			fclose(trace_file);
+		}
+		return NULL;
+	}
+
+	fseek(trace_file, 0, SEEK_END);
+	size_t max_ops = ftell(trace_file) / sizeof(trace_record_t);	// no more records than this fit in the file
+	fseek(trace_file, TRACE_MAGIC_SIZE, SEEK_SET);
+
+	size_t table_size = 1024;
+	while (table_size < 2 * max_ops)
+	{
+		table_size *= 2;
+	}
+
+	replay_op_t *ops = malloc((max_ops + 1) * sizeof(replay_op_t));
+	live_block_t *table = malloc(table_size * sizeof(live_block_t));
+	if (ops == NULL || table == NULL)
+	{
+		printf("Could not allocate room for %zu calls\n", max_ops);
+		fclose(trace_file);
+		free(ops);
+		free(table);
+		return NULL;
+	}
+	memset(table, 0xFF, table_size * sizeof(live_block_t));	// every offset is TRACE_NULL_OFFSET
+
+	trace_record_t record;
+	long dropped = 0;
+	*num_ops = 0;
+	*num_blocks = 0;
+
+	while (fread(&record, sizeof(trace_record_t), 1, trace_file) == 1)
+	{
+		if (record.op == TRACE_FILE)	// file names are only needed for reports
+		{
+			fseek(trace_file, record.size, SEEK_CUR);
+		}
+		else if (record.op == TRACE_MALLOC)
+		{
+			ops[*num_ops].is_free = false;
+			ops[*num_ops].size = record.size;
+			ops[*num_ops].block = *num_blocks;
+			(*num_ops)++;
+
+			if (record.offset != TRACE_NULL_OFFSET)	// later frees of this offset free this block
+			{
+				live_block_t *entry = find_live_block(table, table_size, record.offset);
+				entry->offset = record.offset;
+				entry->block = *num_blocks;
+			}
+			(*num_blocks)++;
+		}
+		else
+		{
+			live_block_t *entry = find_live_block(table, table_size, record.offset);
+			if (entry->offset == TRACE_NULL_OFFSET || entry->block < 0)	// not handed out
+			{
+				dropped++;
+				continue;
+			}
+
+			ops[*num_ops].is_free = true;
+			ops[*num_ops].block = entry->block;
+			(*num_ops)++;
+			entry->block = -1;
+		}
+	}
+
+	if (dropped > 0)
+	{
+		printf("Dropped %ld frees of blocks that were not handed out\n", dropped);
+	}
+
+	fclose(trace_file);
+	free(table);
+	return ops;
+}
+
+/*
+ * Runs a list of calls at full speed, ignoring the timestamps they were recorded with.
+ * @param *ops Calls from load_trace()
+ * @param num_ops Number of calls
+ * @param *blocks Room for a pointer per malloc()
+ * @param (*alloc)(size_t) Allocator's malloc()
+ * @param (*release)(void*) Allocator's free()
+ * @return Time the calls took, in seconds
+ */
+double replay(replay_op_t *ops, long num_ops, void **blocks, void *(*alloc)(size_t), void (*release)(void*))
+{
+	struct timespec start, end;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < num_ops; i++)
+	{
+		if (ops[i].is_free)
+		{
+			if (blocks[ops[i].block] != NULL)	// skip frees of blocks this allocator could not hand out
+			{
+				release(blocks[ops[i].block]);
+			}
+		}
+		else
+		{
+			blocks[ops[i].block] = alloc(ops[i].size);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+	bool use_glibc = false;
+	bool csv = false;
+	const char *path = NULL;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--glibc") == 0)
+		{
+			use_glibc = true;
+		}
+		else if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (path == NULL)
+		{
+			path = argv[i];
+		}
+	}
+
+	if (path == NULL)
+	{
+		printf("Usage: %s [--glibc] [--csv] <trace file>\n", argv[0]);
+		return 1;
+	}
+
+	long num_ops, num_blocks;
+	replay_op_t *ops = load_trace(path, &num_ops, &num_blocks);
+	if (ops == NULL)
+	{
+		return 1;
+	}
+
+	void **blocks = calloc(num_blocks + 1, sizeof(void*));
+	if (blocks == NULL)
+	{
+		printf("Could not allocate room for %ld blocks\n", num_blocks);
+		return 1;
+	}
+
+	const char *allocator = use_glibc ? "glibc" : "mymalloc";
+	double time_elapsed = use_glibc ? replay(ops, num_ops, blocks, malloc, free) : replay(ops, num_ops, blocks, call_mymalloc, call_myfree);
+
+	if (csv)
+	{
+		printf("trace,allocator,calls,seconds,ops_per_sec\n%s,%s,%ld,%f,%.0f\n", path, allocator, num_ops, time_elapsed, num_ops / time_elapsed);
+	}
+	else
+	{
+		printf("Replayed %ld calls from %s against %s in %f seconds: %.0f ops/sec\n", num_ops, path, allocator, time_elapsed, num_ops / time_elapsed);
+	}
+
+	free(blocks);
+	free(ops);
+	return 0;
+}
@@ -0,0 +1,303 @@
+
+#include "slab.h"
+
+/*
+ * The slab area, and how much of it has ever been carved into slabs.
+ */
+static char *slab_area = NULL;
+static size_t slab_area_size = 0;
+static size_t slab_area_used = 0;
+
+/*
+ * Slabs with at least one free slot, one list per slot size.
+ * Full slabs are in no list, and are put back when one of their slots is freed.
+ */
+static slab_t *partial_slabs[SLAB_NUM_CLASSES];
+
+/*
+ * Empty slabs, ready to be assigned any slot size.
+ */
+static slab_t *empty_slabs = NULL;
+
+/*
+ * Adds a slab to the front of a list.
+ * @param **list Head of the list
+ * @param *slab Slab that is in no list
+ */
+static void push_slab(slab_t **list, slab_t *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list != NULL)
+	{
+		(*list)->prev = slab;
+	}
+	*list = slab;
+}
+
+/*
+ * Unlinks a slab from a list.
+ * @param **list Head of the list
+ * @param *slab Slab that is in the list
+ */
+static void unlink_slab(slab_t **list, slab_t *slab)
+{
+	if (slab->prev != NULL)
+	{
+		slab->prev->next = slab->next;
+	}
+	else	// slab was the head of the list
+	{
+		*list = slab->next;
+	}
+
+	if (slab->next != NULL)
+	{
+		slab->next->prev = slab->prev;
+	}
+}
+
+/*
+ * Takes an empty slab, or carves a new one out of the slab area, and lays it out for one slot size.
+ * @param class Index of the slot size
+ * @return The slab, or NULL if the slab area is full
+ */
+static slab_t *create_slab(int class)
+{
+	slab_t *slab = empty_slabs;
+
+	if (slab != NULL)
+	{
+		unlink_slab(&empty_slabs, slab);
+	}
+	else if (slab_area_used + SLAB_SIZE <= slab_area_size)
+	{
+		slab = (slab_t*) (slab_area + slab_area_used);
+		slab_area_used += SLAB_SIZE;
+	}
+	else	// slab area is full
+	{
+		return NULL;
+	}
+
+	unsigned short slot_size = (class + 1) * SLAB_QUANTUM;
+	unsigned short first_slot = (sizeof(slab_t) + 15) & ~15;	// keep the slots 16-byte aligned, like the slab
+
+	slab->slot_size = slot_size;
+	slab->first_slot = first_slot;
+	slab->num_slots = (SLAB_SIZE - first_slot) / slot_size;
+	slab->free_slots = slab->num_slots;
+
+	int i;
+	for (i = 0; i < SLAB_BITMAP_WORDS; i++)
+	{
+		slab->bitmap[i] = 0;
+		slab->cached[i] = 0;
+	}
+
+	push_slab(&partial_slabs[class], slab);
+	return slab;
+}
+
+/*
+ * Sets up an empty slab area. Slabs are carved out of it as they are needed.
+ * @param *area Start of the area, aligned to SLAB_SIZE, readable and writable
+ * @param area_size Size of the area in bytes
+ */
+void slab_init(char *area, size_t area_size)
+{
+	slab_area = area;
+	slab_area_size = area_size - area_size % SLAB_SIZE;
+	slab_area_used = 0;
+	empty_slabs = NULL;
+
+	int i;
+	for (i = 0; i < SLAB_NUM_CLASSES; i++)
+	{
+		partial_slabs[i] = NULL;
+	}
+}
+
+/*
+ * Determines whether or not a pointer lies within the slab area.
+ * @param *ptr Prospective pointer
+ * @return True if the pointer is in the slab area, false otherwise
+ */
+bool slab_owns(void *ptr)
+{
+	return slab_area != NULL && (void*) slab_area <= ptr && ptr < (void*) (slab_area + slab_area_used);
+}
+
+/*
+ * Determines which slot size serves a request.
+ * @param request_size Amount of bytes requested, at most SLAB_MAX_SIZE
+ * @return Index of the slot size
+ */
+int slab_class(unsigned int request_size)
+{
+	return (request_size + SLAB_QUANTUM - 1) / SLAB_QUANTUM - 1;
+}
+
+/*
+ * Hands out a free slot of the right size, starting a new slab if every slab of that size is full.
+ * @param request_size Amount of bytes requested, at most SLAB_MAX_SIZE
+ * @return Pointer to the slot, or NULL if the slab area is full
+ */
+void *slab_alloc(unsigned int request_size)
+{
+	int class = slab_class(request_size);
+	slab_t *slab = partial_slabs[class];
+
+	if (slab == NULL)	// every slab of this size is full
+	{
+		slab = create_slab(class);
+		if (slab == NULL)
+		{
+			return NULL;
+		}
+	}
+
+	int word = 0;
+	while (slab->bitmap[word] == ~0ULL)	// a partial slab always has a clear bit
+	{
+		word++;
+	}
+
+	int slot = word * 64 + __builtin_ctzll(~slab->bitmap[word]);
+	slab->bitmap[word] |= 1ULL << (slot % 64);
+	slab->free_slots--;
+
+	if (slab->free_slots == 0)	// slab is full, stop looking at it
+	{
+		unlink_slab(&partial_slabs[class], slab);
+	}
+
+	return (char*) slab + slab->first_slot + slot * slab->slot_size;
+}
+
+/*
+ * Finds the slab an address belongs to, and the slot it is the start of.
+ * @param *ptr Pointer within the slab area
+ * @param **slab Set to the slab holding ptr
+ * @return Index of the slot, or -1 if ptr is not the start of a slot
+ */
+static int find_slot(void *ptr, slab_t **slab)
+{
+	size_t offset = (char*) ptr - slab_area;
+	*slab = (slab_t*) (slab_area + offset - offset % SLAB_SIZE);
+
+	int slot_offset = (int) (offset % SLAB_SIZE) - (*slab)->first_slot;
+	if ((*slab)->slot_size == 0 || slot_offset < 0 || slot_offset % (*slab)->slot_size != 0)	// inside the header or the middle of a slot
+	{
+		return -1;
+	}
+
+	int slot = slot_offset / (*slab)->slot_size;
+	return slot < (*slab)->num_slots ? slot : -1;
+}
+
+/*
+ * Returns an object to its slab. A slab that becomes empty is kept for any slot size to reuse.
+ * @param *ptr Pointer within the slab area
+ * @return Whether the slot was freed, and if not, why
+ */
+slab_result slab_free(void *ptr)
+{
+	slab_t *slab;
+	int slot = find_slot(ptr, &slab);
+
+	if (slot < 0)
+	{
+		return SLAB_NOT_A_SLOT;
+	}
+
+	uint64_t mask = 1ULL << (slot % 64);
+	if (!(slab->bitmap[slot / 64] & mask) || (__atomic_load_n(&slab->cached[slot / 64], __ATOMIC_RELAXED) & mask))	// slot is not handed out, or was freed into a thread cache
+	{
+		return SLAB_ALREADY_FREED;
+	}
+
+	int class = slab_class(slab->slot_size);
+	slab->bitmap[slot / 64] &= ~mask;
+	slab->free_slots++;
+
+	if (slab->free_slots == 1)	// slab was full, it can be used again
+	{
+		push_slab(&partial_slabs[class], slab);
+	}
+	else if (slab->free_slots == slab->num_slots && partial_slabs[class] != slab)	// slab is empty, and is not the only slab of its size with space
+	{
+		unlink_slab(&partial_slabs[class], slab);
+		slab->slot_size = 0;
+		push_slab(&empty_slabs, slab);
+	}
+
+	return SLAB_FREED;
+}
+
+/*
+ * Looks up the size of the slot holding an object.
+ * @param *ptr Pointer within the slab area
+ * @return Size of the slot if ptr is a slot that is handed out to the user, and 0 otherwise
+ */
+unsigned int slab_usable_size(void *ptr)
+{
+	slab_t *slab;
+	int slot = find_slot(ptr, &slab);
+
+	if (slot < 0)
+	{
+		return 0;
+	}
+
+	uint64_t mask = 1ULL << (slot % 64);
+	if (!(slab->bitmap[slot / 64] & mask) || (__atomic_load_n(&slab->cached[slot / 64], __ATOMIC_RELAXED) & mask))	// free, or freed into a thread cache
+	{
+		return 0;
+	}
+
+	return slab->slot_size;
+}
+
+/*
+ * Looks up the size of the slot holding an object, whether it is handed out to the user or marked as cached.
+ * @param *ptr Pointer to a slot that is handed out or cached
+ * @return Size of the slot
+ */
+unsigned int slab_slot_size(void *ptr)
+{
+	size_t offset = (char*) ptr - slab_area;
+	return ((slab_t*) (slab_area + offset - offset % SLAB_SIZE))->slot_size;	// a slab keeps its slot size while any slot is in use
+}
+
+/*
+ * Records that a slot was put in a thread cache. Threads free into their caches without a lock, so the bit is set atomically,
+ * and of two threads caching the same slot, only one succeeds.
+ * @param *ptr Pointer to a slot that is handed out
+ * @return True if the slot was marked, false if it already was, meaning it sits in some thread's cache
+ */
+bool slab_mark_cached(void *ptr)
+{
+	slab_t *slab;
+	int slot = find_slot(ptr, &slab);
+
+	if (slot < 0)
+	{
+		return false;
+	}
+
+	uint64_t mask = 1ULL << (slot % 64);
+	return !(__atomic_fetch_or(&slab->cached[slot / 64], mask, __ATOMIC_RELAXED) & mask);	// of two threads caching one slot, only one sees the bit clear
+}
+
+/*
+ * Records that a slot left a thread cache, to be handed out to the user again or returned to its slab.
+ * @param *ptr Pointer to a slot that is marked as cached
+ */
+void slab_unmark_cached(void *ptr)
+{
+	slab_t *slab;
+	int slot = find_slot(ptr, &slab);
+
+	__atomic_fetch_and(&slab->cached[slot / 64], ~(1ULL << (slot % 64)), __ATOMIC_RELAXED);	// neighbouring bits may be changed by threads freeing into their caches
+}
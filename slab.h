@@ -0,0 +1,137 @@
+/*
+ * slab.h
+ *
+ *  Slab allocator for tiny objects.
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Size of one slab. Slabs are aligned to this within the slab area, so the slab holding any object is found by rounding its address down.
+ */
+#define SLAB_SIZE 4096
+
+/*
+ * Slot sizes are multiples of this. It matches NODE_ALIGNMENT, so a slot is aligned as well as a node would have been.
+ */
+#ifdef MYMALLOC_ALIGN16
+#define SLAB_QUANTUM 16
+#else
+#define SLAB_QUANTUM 4
+#endif
+
+/*
+ * Largest request served from slabs. Anything bigger gets a node.
+ */
+#define SLAB_MAX_SIZE 64
+
+/*
+ * Number of slot sizes, one for every multiple of SLAB_QUANTUM up to SLAB_MAX_SIZE.
+ */
+#define SLAB_NUM_CLASSES (SLAB_MAX_SIZE / SLAB_QUANTUM)
+
+/*
+ * Number of 64-bit words in a slab's bitmap, enough for a slab full of the smallest slots.
+ */
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / SLAB_QUANTUM / 64)
+
+/*
+ * Size of the address range set aside for slabs, in bytes.
+ * Only slabs that are actually used take up memory.
+ */
+#ifndef MYMALLOC_SLAB_AREA_SIZE
+#define MYMALLOC_SLAB_AREA_SIZE (64 * 1024 * 1024)
+#endif
+
+/*
+ * Header at the start of every slab. The rest of the slab is an array of equally sized slots with no header of their own.
+ */
+typedef struct slab_t {
+	struct slab_t *prev;	// Previous slab in the same list, or NULL
+	struct slab_t *next;	// Next slab in the same list, or NULL
+	unsigned short slot_size;	// Size of every slot in this slab, or 0 if the slab is empty and unassigned
+	unsigned short num_slots;	// Number of slots that fit in this slab
+	unsigned short free_slots;	// Number of slots not handed out
+	unsigned short first_slot;	// Offset of the first slot from the start of the slab
+	uint64_t bitmap[SLAB_BITMAP_WORDS];	// Bit i is set if slot i is handed out
+	uint64_t cached[SLAB_BITMAP_WORDS];	// Bit i is set if slot i is handed out to a thread cache rather than the user
+} slab_t;
+
+/*
+ * Result of returning an object to its slab.
+ * SLAB_FREED means the slot is free for reuse.
+ * SLAB_ALREADY_FREED means the address is a slot, but it was not handed out, or sits in a thread cache.
+ * SLAB_NOT_A_SLOT means the address is not the start of any slot.
+ */
+enum _slab_result {SLAB_FREED, SLAB_ALREADY_FREED, SLAB_NOT_A_SLOT};
+typedef enum _slab_result slab_result;
+
+/*
+ * Sets up an empty slab area. Slabs are carved out of it as they are needed.
+ * @param *area Start of the area, aligned to SLAB_SIZE, readable and writable
+ * @param area_size Size of the area in bytes
+ */
+void slab_init(char *area, size_t area_size);
+
+/*
+ * Determines whether or not a pointer lies within the slab area.
+ * @param *ptr Prospective pointer
+ * @return True if the pointer is in the slab area, false otherwise
+ */
+bool slab_owns(void *ptr);
+
+/*
+ * Determines which slot size serves a request.
+ * @param request_size Amount of bytes requested, at most SLAB_MAX_SIZE
+ * @return Index of the slot size
+ */
+int slab_class(unsigned int request_size);
+
+/*
+ * Hands out a free slot of the right size, starting a new slab if every slab of that size is full.
+ * @param request_size Amount of bytes requested, at most SLAB_MAX_SIZE
+ * @return Pointer to the slot, or NULL if the slab area is full
+ */
+void *slab_alloc(unsigned int request_size);
+
+/*
+ * Returns an object to its slab. A slab that becomes empty is kept for any slot size to reuse.
+ * @param *ptr Pointer within the slab area
+ * @return Whether the slot was freed, and if not, why
+ */
+slab_result slab_free(void *ptr);
+
+/*
+ * Looks up the size of the slot holding an object.
+ * @param *ptr Pointer within the slab area
+ * @return Size of the slot if ptr is a slot that is handed out to the user, and 0 otherwise
+ */
+unsigned int slab_usable_size(void *ptr);
+
+/*
+ * Looks up the size of the slot holding an object, whether it is handed out to the user or marked as cached.
+ * @param *ptr Pointer to a slot that is handed out or cached
+ * @return Size of the slot
+ */
+unsigned int slab_slot_size(void *ptr);
+
+/*
+ * Records that a slot was put in a thread cache. Threads free into their caches without a lock, so the bit is set atomically,
+ * and of two threads caching the same slot, only one succeeds.
+ * @param *ptr Pointer to a slot that is handed out
+ * @return True if the slot was marked, false if it already was, meaning it sits in some thread's cache
+ */
+bool slab_mark_cached(void *ptr);
+
+/*
+ * Records that a slot left a thread cache, to be handed out to the user again or returned to its slab.
+ * @param *ptr Pointer to a slot that is marked as cached
+ */
+void slab_unmark_cached(void *ptr);
+
+#endif /* SLAB_H_ */
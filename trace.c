@@ -0,0 +1,153 @@
+
+#include "trace.h"
+#include "mymalloc.h"
+#include <string.h>
+#include <time.h>
+
+#ifdef MYMALLOC_THREAD_SAFE
+#include <pthread.h>
+
+/*
+ * Keeps records from different threads from interleaving.
+ */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define lock_trace() pthread_mutex_lock(&trace_lock)
+#define unlock_trace() pthread_mutex_unlock(&trace_lock)
+#else
+#define lock_trace()
+#define unlock_trace()
+#endif
+
+/*
+ * The trace file, and the time it was opened.
+ */
+static FILE *trace_file = NULL;
+static struct timespec trace_start;
+
+/*
+ * Source files named in the trace so far. __FILE__ is a string literal, so files are told apart by address.
+ */
+static char *trace_files[TRACE_MAX_FILES];
+static int num_trace_files = 0;
+
+/*
+ * Set while the calling thread writes a record, so calls made by stdio itself are not traced.
+ */
+#ifdef MYMALLOC_THREAD_SAFE
+static __thread bool in_trace = false;
+#else
+static bool in_trace = false;
+#endif
+
+/*
+ * Starts a trace file, replacing one that is already open.
+ * @param *path Path of the file to write
+ * @return True if the file was opened, false otherwise
+ */
+bool trace_open(const char *path)
+{
+	trace_close();
+
+	trace_file = fopen(path, "wb");
+	if (trace_file == NULL)
+	{
+		return false;
+	}
+
+	fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, trace_file);
+	clock_gettime(CLOCK_MONOTONIC, &trace_start);
+	num_trace_files = 0;
+	return true;
+}
+
+/*
+ * Flushes and closes the trace file. Later calls start a new one.
+ */
+void trace_close()
+{
+	if (trace_file != NULL)
+	{
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+}
+
+/*
+ * Looks up the index of a source file, naming it in the trace the first time it is seen.
+ * @param *filename __FILE__ of a call
+ * @param *record Record the file name record can be built in
+ * @return Index of the file, or TRACE_UNKNOWN_FILE if too many files have been named
+ */
+static uint16_t get_file_id(char *filename, trace_record_t *record)
+{
+	int i;
+	for (i = 0; i < num_trace_files; i++)
+	{
+		if (trace_files[i] == filename)
+		{
+			return i;
+		}
+	}
+
+	if (num_trace_files == TRACE_MAX_FILES)
+	{
+		return TRACE_UNKNOWN_FILE;
+	}
+
+	trace_files[num_trace_files] = filename;
+	record->op = TRACE_FILE;
+	record->size = strlen(filename);
+	record->file_id = num_trace_files;
+	fwrite(record, sizeof(trace_record_t), 1, trace_file);
+	fwrite(filename, 1, record->size, trace_file);
+
+	return num_trace_files++;
+}
+
+/*
+ * Appends a call to the trace, opening the trace file first if needed.
+ * @param op TRACE_MALLOC or TRACE_FREE
+ * @param size Bytes asked for, or 0 for frees
+ * @param *ptr Block returned or freed, or NULL
+ * @param line __LINE__ of the call
+ * @param *filename __FILE__ of the call
+ */
+void trace_record(trace_op op, size_t size, void *ptr, int line, char *filename)
+{
+	struct timespec now;
+	trace_record_t record = {0};
+
+	if (in_trace)	// stdio allocating while a record is written
+	{
+		return;
+	}
+	in_trace = true;
+	lock_trace();
+
+	if (trace_file == NULL)	// first call, start the trace and make sure it is flushed at exit
+	{
+		char *path = getenv("MYMALLOC_TRACE_FILE");
+		if (trace_open(path != NULL ? path : TRACE_DEFAULT_PATH))
+		{
+			atexit(trace_close);
+		}
+	}
+
+	if (trace_file != NULL)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		uint16_t file_id = get_file_id(filename, &record);
+		record.op = op;
+		record.size = size;
+		record.offset = ptr != NULL ? (uint64_t) ((char*) ptr - myblock) : TRACE_NULL_OFFSET;
+		record.timestamp = (now.tv_sec - trace_start.tv_sec) * 1000000000ULL + now.tv_nsec - trace_start.tv_nsec;
+		record.line = line;
+		record.file_id = file_id;
+		fwrite(&record, sizeof(trace_record_t), 1, trace_file);
+	}
+
+	unlock_trace();
+	in_trace = false;
+}
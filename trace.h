@@ -0,0 +1,86 @@
+/*
+ * trace.h
+ *
+ *  Recording of mymalloc() and myfree() calls into a binary trace, for replaying later.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Tracing mode, enabled by building with -DMYMALLOC_TRACE.
+ * Every mymalloc() call, and every myfree() call that frees a block, is appended to a trace file.
+ * The file is opened on the first call, at the path in the MYMALLOC_TRACE_FILE environment variable, or at TRACE_DEFAULT_PATH.
+ * It is flushed when the program exits, or when trace_close() is called.
+ */
+
+/*
+ * Path of the trace file if MYMALLOC_TRACE_FILE is not set.
+ */
+#define TRACE_DEFAULT_PATH "mymalloc.trace"
+
+/*
+ * First bytes of every trace file, followed by the records.
+ */
+#define TRACE_MAGIC "MMTRACE2"	// version 2 widened the size to 64 bits
+#define TRACE_MAGIC_SIZE 8
+
+/*
+ * Offset recorded for a mymalloc() call that returned NULL.
+ */
+#define TRACE_NULL_OFFSET UINT64_MAX
+
+/*
+ * Most distinct source files a trace can name. Calls from any others are recorded with TRACE_UNKNOWN_FILE.
+ */
+#define TRACE_MAX_FILES 1024
+#define TRACE_UNKNOWN_FILE UINT16_MAX
+
+/*
+ * Kinds of trace records.
+ * TRACE_MALLOC is a mymalloc() call, with the size asked for and the offset of the block from myblock.
+ * TRACE_FREE is a myfree() call that freed the block at the recorded offset.
+ * TRACE_FILE names a source file the first time a call comes from it. Its size is the length of the name, which follows the record.
+ */
+enum _trace_op {TRACE_MALLOC, TRACE_FREE, TRACE_FILE};
+typedef enum _trace_op trace_op;
+
+/*
+ * One record of a trace, packed so a record takes 31 bytes on disk.
+ */
+typedef struct __attribute__((packed)) trace_record_t {
+	uint8_t op;	// A trace_op
+	uint64_t size;	// Bytes asked for, 0 for frees, or the length of the file name. 64 bits wide, so requests of 4 GiB or more are kept whole.
+	uint64_t offset;	// Offset of the block from myblock, or TRACE_NULL_OFFSET
+	uint64_t timestamp;	// Nanoseconds since the trace was opened
+	uint32_t line;	// __LINE__ of the call
+	uint16_t file_id;	// Index of __FILE__ of the call, as named by an earlier TRACE_FILE record
+} trace_record_t;
+
+/*
+ * Starts a trace file, replacing one that is already open.
+ * @param *path Path of the file to write
+ * @return True if the file was opened, false otherwise
+ */
+bool trace_open(const char *path);
+
+/*
+ * Flushes and closes the trace file. Later calls start a new one.
+ */
+void trace_close();
+
+/*
+ * Appends a call to the trace, opening the trace file first if needed.
+ * @param op TRACE_MALLOC or TRACE_FREE
+ * @param size Bytes asked for, or 0 for frees
+ * @param *ptr Block returned or freed, or NULL
+ * @param line __LINE__ of the call
+ * @param *filename __FILE__ of the call
+ */
+void trace_record(trace_op op, size_t size, void *ptr, int line, char *filename);
+
+#endif /* TRACE_H_ */